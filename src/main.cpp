@@ -1,4 +1,6 @@
-﻿#include "ng.h"
+﻿#include <string.h>
+
+#include "ng.h"
 
 enum {
   KEY_UP,
@@ -10,7 +12,20 @@ enum {
 };
 
 int main(int argc, char* argv[]) {
-  auto proc = ngProcess::NewProcess();
+  // --record <path> records input, and --replay <path> replays it without
+  // window as a benchmark.
+  const char* record_path = nullptr;
+  const char* replay_path = nullptr;
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--record") == 0) {
+      record_path = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0) {
+      replay_path = argv[++i];
+    }
+  }
+
+  auto proc = ngProcess::NewProcess(replay_path ? ngBackend::SOFTWARE
+                                                : ngBackend::OPENGL);
   proc->MapKeyboard('w', KEY_UP);
   proc->MapKeyboard('a', KEY_LEFT);
   proc->MapKeyboard('s', KEY_DOWN);
@@ -23,6 +38,12 @@ int main(int argc, char* argv[]) {
   if (!proc->Init()) {
     return 1;
   }
+  if (record_path && !proc->StartRecording(record_path)) {
+    return 1;
+  }
+  if (replay_path && !proc->StartReplay(replay_path)) {
+    return 1;
+  }
   float x = 0.f;
   int button_press_count = 0;
   vec2 pos(0.f, 0.f);
@@ -65,4 +86,11 @@ int main(int argc, char* argv[]) {
     p.Text(black, {-320, 0}, 30, txt.c_str());
     p.Square(white, white, pos, 10);
   });
+
+  if (replay_path) {
+    const ngFrameStats& stats = proc->FrameStats();
+    printf("replayed %d frames in %.3f sec (%.1f fps)\n", stats.replay_frames,
+           stats.replay_time,
+           stats.replay_frames / max(stats.replay_time, 1e-9f));
+  }
 }
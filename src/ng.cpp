@@ -10,15 +10,40 @@
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NG_USE_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#define NG_USE_AVX2
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cfloat>
+#include <cstddef>
+#include <cstring>
+#include <deque>
 #include <functional>
 //
 #include <ft2build.h>
 #include FT_FREETYPE_H
 //
 #include <fmt/format.h>
+#include <glm/gtc/type_precision.hpp>
 
-#include <map>
+#include <atomic>
+#include <condition_variable>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
 
 #include "utf8.h"
 //
@@ -30,27 +55,29 @@ class TickCounter {
   static const uint32_t kTickCounterInterval = 512;
 
  private:
-  std::vector<uint32_t> tick_times;
+  std::vector<uint64_t> tick_times;
   uint32_t tick_times_index;
+  double seconds_per_tick;
 
  public:
   void Reset() {
     tick_times.clear();
     tick_times_index = 0;
+    seconds_per_tick = 1.0 / double(SDL_GetPerformanceFrequency());
   }
-  uint32_t PrevTick() {
+  uint64_t PrevTick() {
     uint32_t prev_index =
         (kTickCounterInterval + tick_times_index - 1) % kTickCounterInterval;
     return tick_times[prev_index];
   }
-  uint32_t MostOldTick() {
+  uint64_t MostOldTick() {
     uint32_t old_index = (tick_times_index + 1) % kTickCounterInterval;
     return tick_times[old_index];
   }
-  uint32_t NowTick() { return tick_times[tick_times_index]; }
+  uint64_t NowTick() { return tick_times[tick_times_index]; }
   bool IsLogEnough() { return tick_times.size() == kTickCounterInterval; }
   void Remember() {
-    uint32_t now = SDL_GetTicks();
+    uint64_t now = SDL_GetPerformanceCounter();
     if (!IsLogEnough()) {
       tick_times.push_back(now);
       tick_times_index = tick_times.size() - 1;
@@ -63,19 +90,362 @@ class TickCounter {
     if (!IsLogEnough()) {
       return 0.f;
     } else {
-      uint32_t old = MostOldTick();
-      uint32_t now = NowTick();
-      return kTickCounterInterval * 1000.f / float(now - old);
+      uint64_t old = MostOldTick();
+      uint64_t now = NowTick();
+      return kTickCounterInterval / float((now - old) * seconds_per_tick);
     }
   }
-  uint32_t ElapsedTickMsec() {
+  double ElapsedSec() {
     if (tick_times.size() < 2) {
-      return 0;
+      return 0.0;
+    } else {
+      return (NowTick() - PrevTick()) * seconds_per_tick;
+    }
+  }
+};
+
+// FrameProfiler measures time spent in each phase of frames, and keeps
+// recent history of them to compute percentiles.
+class FrameProfiler {
+ public:
+  static const int kHistoryNum = TickCounter::kTickCounterInterval;
+
+ private:
+  double seconds_per_tick_;
+  uint64_t frame_begin_;
+  float phase_time_[kFramePhaseNum];
+  ngFrameCounters counters_;
+
+  std::vector<float> history_[kFramePhaseNum];
+  int history_index_;
+  std::vector<float> sorted_;
+  bool percentile_dirty_;
+
+  ngFrameStats stats_;
+
+ public:
+  void Reset() {
+    seconds_per_tick_ = 1.0 / double(SDL_GetPerformanceFrequency());
+    for (auto& history : history_) {
+      history.clear();
+      history.reserve(kHistoryNum);
+    }
+    history_index_ = 0;
+    sorted_.reserve(kHistoryNum);
+    percentile_dirty_ = false;
+    stats_ = ngFrameStats();
+  }
+
+  uint64_t Now() const { return SDL_GetPerformanceCounter(); }
+
+  void BeginFrame() {
+    frame_begin_ = Now();
+    std::fill(std::begin(phase_time_), std::end(phase_time_), 0.f);
+    counters_ = ngFrameCounters();
+  }
+
+  // AddPhase accumulates time since begin to the phase.
+  void AddPhase(ngFramePhase phase, uint64_t begin) {
+    phase_time_[int(phase)] += float((Now() - begin) * seconds_per_tick_);
+  }
+
+  ngFrameCounters& Counters() { return counters_; }
+
+  void SetReplay(int frames, float seconds) {
+    stats_.replay_frames = frames;
+    stats_.replay_time = seconds;
+  }
+
+  // PhaseTime returns seconds spent in the phase so far in this frame.
+  float PhaseTime(ngFramePhase phase) const { return phase_time_[int(phase)]; }
+
+  void EndFrame(float fps) {
+    AddPhase(ngFramePhase::TOTAL, frame_begin_);
+    for (int i = 0; i < kFramePhaseNum; i++) {
+      std::vector<float>& history = history_[i];
+      if ((int)history.size() < kHistoryNum) {
+        history.push_back(phase_time_[i]);
+      } else {
+        history[history_index_] = phase_time_[i];
+      }
+      stats_.time[i] = phase_time_[i];
+    }
+    history_index_ = (history_index_ + 1) % kHistoryNum;
+    stats_.counters = counters_;
+    stats_.fps = fps;
+    percentile_dirty_ = true;
+  }
+
+  // Stats returns stats of the last completed frame.
+  const ngFrameStats& Stats() {
+    if (percentile_dirty_) {
+      for (int i = 0; i < kFramePhaseNum; i++) {
+        stats_.p50[i] = Percentile(i, 0.50f);
+        stats_.p95[i] = Percentile(i, 0.95f);
+        stats_.p99[i] = Percentile(i, 0.99f);
+      }
+      percentile_dirty_ = false;
+    }
+    return stats_;
+  }
+
+ private:
+  float Percentile(int phase, float p) {
+    const std::vector<float>& history = history_[phase];
+    if (history.empty()) {
+      return 0.f;
+    }
+    sorted_.assign(history.begin(), history.end());
+    auto nth = sorted_.begin() + int(p * (sorted_.size() - 1) + 0.5f);
+    std::nth_element(sorted_.begin(), nth, sorted_.end());
+    return *nth;
+  }
+};
+
+// ScopedPhase adds time until the end of scope to the phase.
+class ScopedPhase {
+ private:
+  FrameProfiler& profiler_;
+  ngFramePhase phase_;
+  uint64_t begin_;
+
+ public:
+  ScopedPhase(FrameProfiler& profiler, ngFramePhase phase)
+      : profiler_(profiler), phase_(phase), begin_(profiler.Now()) {}
+  ~ScopedPhase() { profiler_.AddPhase(phase_, begin_); }
+};
+
+// ProfileEvent is begin of a zone, or end of the innermost zone if name is
+// nullptr.
+struct ProfileEvent {
+  const char* name;
+  uint64_t tick;
+};
+
+// ProfileRing keeps recent events of a thread. Only the owner thread writes,
+// so writes don't lock. Oldest events are overwritten when full.
+class ProfileRing {
+ public:
+  static const uint64_t kCapacity = 1 << 16;
+
+ private:
+  int thread_id_;
+  std::unique_ptr<ProfileEvent[]> events_;
+  std::atomic<uint64_t> head_;
+
+ public:
+  explicit ProfileRing(int thread_id)
+      : thread_id_(thread_id),
+        events_(new ProfileEvent[kCapacity]),
+        head_(0) {}
+
+  int ThreadId() const { return thread_id_; }
+
+  void Push(const char* name, uint64_t tick) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    events_[head & (kCapacity - 1)] = {name, tick};
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Read copies events in the ring from oldest to newest.
+  void Read(std::vector<ProfileEvent>* out) const {
+    out->clear();
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t begin = head > kCapacity ? head - kCapacity : 0;
+    for (uint64_t i = begin; i < head; i++) {
+      out->push_back(events_[i & (kCapacity - 1)]);
+    }
+    // drop events overwritten by the owner while copying
+    uint64_t new_head = head_.load(std::memory_order_acquire);
+    uint64_t valid_begin = new_head > kCapacity ? new_head - kCapacity : 0;
+    if (valid_begin > begin) {
+      size_t n = std::min<uint64_t>(valid_begin - begin, out->size());
+      out->erase(out->begin(), out->begin() + n);
+    }
+  }
+};
+
+// ProfileRegistry owns rings of all threads. Rings are kept after their
+// thread ends, so that the zones can be exported.
+class ProfileRegistry {
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ProfileRing>> rings_;
+
+ public:
+  static ProfileRegistry& Get() {
+    static ProfileRegistry registry;
+    return registry;
+  }
+
+  ProfileRing* NewRing() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.push_back(std::make_unique<ProfileRing>((int)rings_.size() + 1));
+    return rings_.back().get();
+  }
+
+  template <typename F>
+  void ForEachRing(F f) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& ring : rings_) {
+      f(*ring);
+    }
+  }
+};
+
+ProfileRing& threadProfileRing() {
+  thread_local ProfileRing* ring = ProfileRegistry::Get().NewRing();
+  return *ring;
+}
+
+// escapeJSON escapes characters which can't be in a JSON string as is.
+std::string escapeJSON(const char* str) {
+  std::string out;
+  for (; *str; ++str) {
+    unsigned char c = *str;
+    if (c == '"' || c == '\\') {
+      out.push_back('\\');
+      out.push_back(c);
+    } else if (c < 0x20) {
+      out += fmt::format("\\u{0:04x}", c);
     } else {
-      return NowTick() - PrevTick();
+      out.push_back(c);
+    }
+  }
+  return out;
+}
+
+// LatencyPacer estimates how long a frame can sleep before sampling input
+// without missing vsync, from idle time of recent frames. Idle time is the
+// sleep plus the wait in presenting.
+class LatencyPacer {
+ public:
+  static const int kHistoryNum = 32;
+  // kMargin is seconds left for jitter of the frame work.
+  static constexpr float kMargin = 0.002f;
+
+ private:
+  float idle_[kHistoryNum];
+  int index_;
+  int num_;
+
+ public:
+  void Reset() {
+    index_ = 0;
+    num_ = 0;
+  }
+
+  void AddIdle(float seconds) {
+    idle_[index_] = seconds;
+    index_ = (index_ + 1) % kHistoryNum;
+    num_ = min(num_ + 1, kHistoryNum);
+  }
+
+  // SleepTime returns seconds to sleep, using the shortest recent idle time
+  // to be safe against slow frames.
+  float SleepTime() const {
+    if (num_ < kHistoryNum) {
+      return 0.f;
+    }
+    float idle = *std::min_element(idle_, idle_ + num_);
+    return max(idle - kMargin, 0.f);
+  }
+};
+
+// sleepPrecise sleeps for seconds, spinning for the last milliseconds which
+// SDL_Delay can't wait for precisely.
+void sleepPrecise(double seconds) {
+  uint64_t frequency = SDL_GetPerformanceFrequency();
+  uint64_t end = SDL_GetPerformanceCounter() + uint64_t(seconds * frequency);
+  const double kSpinTime = 0.002;
+  if (seconds > kSpinTime) {
+    SDL_Delay(Uint32((seconds - kSpinTime) * 1000.0));
+  }
+  while (SDL_GetPerformanceCounter() < end) {
+  }
+}
+
+#if !defined(__EMSCRIPTEN__)
+// FrameWorker runs one job at a time on its own thread, to overlap work for
+// the next frame with the rest of the current one.
+class FrameWorker {
+ private:
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::function<void()> job_;
+  bool busy_ = false;
+  bool stop_ = false;
+
+ public:
+  ~FrameWorker() {
+    if (thread_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      cond_.notify_all();
+      thread_.join();
+    }
+  }
+
+  // Start runs job on the worker. The previous job must be waited for.
+  void Start(std::function<void()> job) {
+    if (!thread_.joinable()) {
+      thread_ = std::thread([this] { Loop(); });
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      NG_ASSERT(!busy_);
+      job_ = std::move(job);
+      busy_ = true;
+    }
+    cond_.notify_all();
+  }
+
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return !busy_; });
+  }
+
+ private:
+  void Loop() {
+    for (;;) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return job_ || stop_; });
+        if (stop_) {
+          return;
+        }
+        job = std::move(job_);
+        job_ = nullptr;
+      }
+      job();
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        busy_ = false;
+      }
+      cond_.notify_all();
     }
   }
 };
+#endif
+
+// supportsInstancing returns whether the context has glVertexAttribDivisor
+// and glDrawArraysInstanced, which are core since OpenGL 3.3 and OpenGL ES
+// 3.0. Version queries fail and leave 0 on contexts older than 3.0.
+bool supportsInstancing() {
+  GLint major = 0;
+  GLint minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+#if defined(__EMSCRIPTEN__)
+  return major >= 3;
+#else
+  return major > 3 || (major == 3 && minor >= 3);
+#endif
+}
 
 bool CompileShader(const char* code, GLenum type, GLuint* out_shader_id) {
   GLuint shader_id = glCreateShader(type);
@@ -136,310 +506,2547 @@ bool CompileShaderProgram(const char* vertex_shader_code,
 static const std::vector<vec2> kSquareVertex = {
     {-1, -1}, {-1, 1}, {1, -1}, {1, 1}};
 
-static const std::vector<vec2> kLineVertex = {{0, 0}, {1, 0}};
+static u8vec4 color256ToU8(const ngColor& col) { return u8vec4(col); }
+
+struct PrimitiveVertex {
+  vec2 position;
+  u8vec4 color;
+};
+
+// PrimitiveBatch accumulates already transformed vertices of untextured
+// primitives and submits them with one draw call per run of the same mode.
+class PrimitiveBatch {
+ public:
+  static const size_t kInitialCapacity = 64 * 1024;
+
+ private:
+  ngFrameCounters* counters_;
+  GLuint program_id_;
+  GLuint buffer_id_;
+  GLenum mode_;
+  std::vector<PrimitiveVertex> vertices_;
+
+ public:
+  void Init(GLuint program_id, ngFrameCounters* counters) {
+    counters_ = counters;
+    program_id_ = program_id;
+    glGenBuffers(1, &buffer_id_);
+    mode_ = GL_TRIANGLES;
+    vertices_.reserve(kInitialCapacity);
+  }
+
+  void Release() { glDeleteBuffers(1, &buffer_id_); }
+
+  // Begin switches the primitive mode of following vertices. Pending vertices
+  // of another mode are flushed first to keep the drawing order.
+  void Begin(GLenum mode) {
+    if (mode_ != mode) {
+      Flush();
+      mode_ = mode;
+    }
+  }
+
+  void Add(const vec2& position, const u8vec4& color) {
+    vertices_.push_back({position, color});
+  }
+
+  // Discard drops pending vertices, e.g. when the frame is cleared anyway.
+  void Discard() { vertices_.clear(); }
+
+  void Flush() {
+    if (vertices_.empty()) {
+      return;
+    }
+    glUseProgram(program_id_);
+
+    // upload whole batch at once. glBufferData orphans previous storage so
+    // the driver doesn't have to wait for the last draw.
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_id_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_[0]) * vertices_.size(),
+                 &vertices_[0], GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(PrimitiveVertex),
+                          (void*)offsetof(PrimitiveVertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE,
+                          sizeof(PrimitiveVertex),
+                          (void*)offsetof(PrimitiveVertex, color));
+
+    glDrawArrays(mode_, 0, vertices_.size());
+    counters_->buffer_uploads++;
+    counters_->draw_calls++;
+
+    glDisableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+    vertices_.clear();
+  }
+};
+
+enum class ShapeKind {
+  RECT,
+  CIRCLE,
+};
 
-static vec4 color256To1_0(const ngColor& col) {
-  return vec4(col) * (1.f / 255.f);
+// ShapeInstance is a rect or circle drawn by instancing a unit quad. The
+// transform is a 2x3 affine matrix in columns.
+struct ShapeInstance {
+  vec2 axis_x;
+  vec2 axis_y;
+  vec2 origin;
+  u8vec4 fill;
+  u8vec4 border;
+  // ShapeKind as float for the vertex attribute
+  float kind;
+};
+
+// kShapeBorderWidth is width of shape borders in pixels, same as in the
+// shape shader.
+const float kShapeBorderWidth = 1.f;
+
+// shapeHalfPixels returns half size of a unit shape transformed to NDC by
+// axis_x and axis_y, in pixels of a viewport.
+vec2 shapeHalfPixels(const vec2& axis_x, const vec2& axis_y,
+                     const vec2& viewport) {
+  return {length(axis_x * viewport * 0.5f), length(axis_y * viewport * 0.5f)};
 }
 
-struct InputState {
-  std::vector<uint8_t> key;
-  std::vector<bool> mouse_button;
-  ivec2 mouse_position;
+// shapeDistance returns signed distance in pixels from the edge of a unit
+// rect or circle at local position p, positive inside.
+float shapeDistance(ShapeKind kind, const vec2& p, const vec2& half_px) {
+  if (kind == ShapeKind::CIRCLE) {
+    return (1.f - length(p)) * min(half_px.x, half_px.y);
+  }
+  vec2 e = (vec2(1.f) - abs(p)) * half_px;
+  return min(e.x, e.y);
+}
+
+// ShapeBatch accumulates rects and circles, and draws all of them with one
+// instanced draw call of a unit quad. Only a transform and colors are
+// uploaded per shape instead of transformed vertices, and the shader draws
+// the edge of circles exactly at any size.
+class ShapeBatch {
+ public:
+  static const size_t kInitialCapacity = 16 * 1024;
+
+ private:
+  ngFrameCounters* counters_;
+  GLuint program_id_;
+  GLuint quad_buffer_id_;
+  GLuint instance_buffer_id_;
+  std::vector<ShapeInstance> instances_;
+
+ public:
+  void Init(GLuint program_id, const vec2& viewport,
+            ngFrameCounters* counters) {
+    counters_ = counters;
+    program_id_ = program_id;
+    glUseProgram(program_id);
+    glUniform2f(glGetUniformLocation(program_id, "u_viewport_half"),
+                viewport.x * 0.5f, viewport.y * 0.5f);
+    instances_.reserve(kInitialCapacity);
+
+    glGenBuffers(1, &quad_buffer_id_);
+    glBindBuffer(GL_ARRAY_BUFFER, quad_buffer_id_);
+    glBufferData(GL_ARRAY_BUFFER,
+                 sizeof(kSquareVertex[0]) * kSquareVertex.size(),
+                 &kSquareVertex[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &instance_buffer_id_);
+  }
+
+  void Release() {
+    glDeleteBuffers(1, &quad_buffer_id_);
+    glDeleteBuffers(1, &instance_buffer_id_);
+  }
+
+  void Add(ShapeKind kind, const ngAffine2D& m, const u8vec4& fill,
+           const u8vec4& border) {
+    instances_.push_back(
+        {m.x_axis, m.y_axis, m.origin, fill, border, float(kind)});
+  }
+
+  void Discard() { instances_.clear(); }
+
+  void Flush() {
+    if (instances_.empty()) {
+      return;
+    }
+    glUseProgram(program_id_);
+
+    glBindBuffer(GL_ARRAY_BUFFER, quad_buffer_id_);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(vec2), (void*)0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, instance_buffer_id_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(instances_[0]) * instances_.size(),
+                 &instances_[0], GL_STREAM_DRAW);
+    struct Attribute {
+      GLint size;
+      GLenum type;
+      GLboolean normalized;
+      size_t offset;
+    };
+    const Attribute attributes[] = {
+        {2, GL_FLOAT, GL_FALSE, offsetof(ShapeInstance, axis_x)},
+        {2, GL_FLOAT, GL_FALSE, offsetof(ShapeInstance, axis_y)},
+        {2, GL_FLOAT, GL_FALSE, offsetof(ShapeInstance, origin)},
+        {4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(ShapeInstance, fill)},
+        {4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(ShapeInstance, border)},
+        {1, GL_FLOAT, GL_FALSE, offsetof(ShapeInstance, kind)},
+    };
+    const GLuint kNum = sizeof(attributes) / sizeof(attributes[0]);
+    for (GLuint i = 0; i < kNum; i++) {
+      const Attribute& a = attributes[i];
+      glEnableVertexAttribArray(i + 1);
+      glVertexAttribPointer(i + 1, a.size, a.type, a.normalized,
+                            sizeof(ShapeInstance), (void*)a.offset);
+      glVertexAttribDivisor(i + 1, 1);
+    }
+
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, kSquareVertex.size(),
+                          instances_.size());
+    counters_->buffer_uploads++;
+    counters_->draw_calls++;
+
+    // other batches share the attribute locations without divisor
+    glDisableVertexAttribArray(0);
+    for (GLuint i = 0; i < kNum; i++) {
+      glVertexAttribDivisor(i + 1, 0);
+      glDisableVertexAttribArray(i + 1);
+    }
+    instances_.clear();
+  }
+};
+
+struct TextVertex {
+  vec2 position;
+  vec2 uv;
+  u8vec4 color;
+};
+
+// TextBatch accumulates glyph quads sampling the same glyph atlas page and
+// submits them with one draw call.
+class TextBatch {
+ public:
+  static const size_t kInitialCapacity = 16 * 1024;
+
+ private:
+  ngFrameCounters* counters_;
+  GLuint program_id_;
+  GLuint uniform_texture_id_;
+  GLuint buffer_id_;
+  int page_;
+  std::vector<TextVertex> vertices_;
+
+ public:
+  void Init(GLuint program_id, GLuint uniform_texture_id,
+            ngFrameCounters* counters) {
+    counters_ = counters;
+    program_id_ = program_id;
+    uniform_texture_id_ = uniform_texture_id;
+    glGenBuffers(1, &buffer_id_);
+    page_ = -1;
+    vertices_.reserve(kInitialCapacity);
+  }
+
+  void Release() { glDeleteBuffers(1, &buffer_id_); }
+
+  bool Empty() const { return vertices_.empty(); }
+  int Page() const { return page_; }
+  // SetPage must be called while the batch is empty.
+  void SetPage(int page) { page_ = page; }
+
+  // AddQuad adds a quad whose corners are ordered as a triangle strip.
+  void AddQuad(const vec2 (&pos)[4], const vec2& uv0, const vec2& uv1,
+               const u8vec4& color) {
+    TextVertex v0{pos[0], {uv0.x, uv0.y}, color};
+    TextVertex v1{pos[1], {uv0.x, uv1.y}, color};
+    TextVertex v2{pos[2], {uv1.x, uv0.y}, color};
+    TextVertex v3{pos[3], {uv1.x, uv1.y}, color};
+    vertices_.insert(vertices_.end(), {v0, v1, v2, v2, v1, v3});
+  }
+
+  void Discard() { vertices_.clear(); }
+
+  // Flush draws pending quads. Texture of Page() must be bound to unit 0.
+  void Flush() {
+    if (vertices_.empty()) {
+      return;
+    }
+    glUseProgram(program_id_);
+    glUniform1i(uniform_texture_id_, 0);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_id_);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices_[0]) * vertices_.size(),
+                 &vertices_[0], GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex),
+                          (void*)offsetof(TextVertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(TextVertex),
+                          (void*)offsetof(TextVertex, uv));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(TextVertex),
+                          (void*)offsetof(TextVertex, color));
+
+    glDrawArrays(GL_TRIANGLES, 0, vertices_.size());
+    counters_->buffer_uploads++;
+    counters_->draw_calls++;
+
+    glDisableVertexAttribArray(0);
+    glDisableVertexAttribArray(1);
+    glDisableVertexAttribArray(2);
+    vertices_.clear();
+  }
+};
+
+// GlyphCache rasterizes each glyph once into shelf packed atlas pages.
+// When all pages are full, the least recently used shelf is evicted.
+class GlyphCache {
+ public:
+  static const int kPageSize = 1024;
+  static const int kMaxPages = 4;
+  // empty texels around glyphs so linear filtering doesn't bleed.
+  static const int kPadding = 1;
+
+  struct Glyph {
+    // page is -1 for glyphs without bitmap (e.g. space).
+    int page;
+    int shelf;
+    // bitmap rectangle in the page, bottom row first.
+    ivec2 pos;
+    ivec2 size;
+    // metrics in pixels
+    vec2 bearing;
+    vec2 extent;
+    float advance;
+  };
+
+  struct Page {
+    std::vector<uint8_t> pixels;
+    // rows [dirty_min_y, dirty_max_y) are modified since last upload.
+    int dirty_min_y;
+    int dirty_max_y;
+    int used_height;
+    uint64_t last_used;
+
+    bool IsDirty() const { return dirty_min_y < dirty_max_y; }
+  };
+
+ private:
+  struct Key {
+    FT_Face face;
+    uint32_t codepoint;
+    uint32_t pixel_size;
+
+    bool operator==(const Key& o) const {
+      return face == o.face && codepoint == o.codepoint &&
+             pixel_size == o.pixel_size;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key& k) const {
+      uint64_t h = reinterpret_cast<uintptr_t>(k.face);
+      h = h * 0x9e3779b97f4a7c15 + k.codepoint;
+      h = h * 0x9e3779b97f4a7c15 + k.pixel_size;
+      return static_cast<size_t>(h ^ (h >> 29));
+    }
+  };
+
+  struct Shelf {
+    int page;
+    int y;
+    // height is 0 if the shelf slot is unused.
+    int height;
+    int x;
+    uint64_t last_used;
+    std::vector<Key> keys;
+  };
+
+  std::unordered_map<Key, Glyph, KeyHash> glyphs_;
+  std::vector<Shelf> shelves_;
+  std::vector<Page> pages_;
+  uint64_t frame_ = 0;
+  std::function<void()> before_evict_;
+
+ public:
+  // SetBeforeEvict registers a callback invoked before glyphs are evicted,
+  // so that pending draws referring them can be submitted.
+  void SetBeforeEvict(std::function<void()> before_evict) {
+    before_evict_ = before_evict;
+  }
+
+  // NextFrame advances the clock used for LRU eviction.
+  void NextFrame() { frame_++; }
+
+  int PageNum() const { return pages_.size(); }
+  const Page& GetPage(int page) const { return pages_[page]; }
+  void MarkUploaded(int page) {
+    pages_[page].dirty_min_y = kPageSize;
+    pages_[page].dirty_max_y = 0;
+  }
+
+  // Get returns cached glyph, rasterizing it on a miss. The returned pointer
+  // is valid until next call of Get. Returns nullptr on failure.
+  const Glyph* Get(FT_Face face, uint32_t codepoint, uint32_t pixel_size) {
+    Key key{face, codepoint, pixel_size};
+    auto it = glyphs_.find(key);
+    if (it == glyphs_.end()) {
+      return Rasterize(key);
+    }
+    Glyph& glyph = it->second;
+    if (glyph.page >= 0) {
+      shelves_[glyph.shelf].last_used = frame_;
+      pages_[glyph.page].last_used = frame_;
+    }
+    return &glyph;
+  }
+
+ private:
+  const Glyph* Rasterize(const Key& key) {
+    if (FT_Set_Pixel_Sizes(key.face, 0, key.pixel_size) != 0) {
+      fprintf(stderr, "failed to FT_Set_Pixel_Sizes\n");
+      return nullptr;
+    }
+    if (FT_Load_Glyph(key.face, FT_Get_Char_Index(key.face, key.codepoint),
+                      FT_LOAD_RENDER | FT_LOAD_COLOR) != 0) {
+      fprintf(stderr, "failed to FT_Load_Glyph\n");
+      return nullptr;
+    }
+
+    const FT_GlyphSlot& slot = key.face->glyph;
+    const FT_Bitmap& bitmap = slot->bitmap;
+    const FT_Glyph_Metrics& metrics = slot->metrics;
+
+    Glyph glyph;
+    glyph.page = -1;
+    glyph.shelf = -1;
+    glyph.size = {bitmap.width, bitmap.rows};
+    glyph.bearing = vec2(metrics.horiBearingX,
+                         metrics.horiBearingY - metrics.height) /
+                    64.f;
+    glyph.extent = vec2(metrics.width, metrics.height) / 64.f;
+    glyph.advance = metrics.horiAdvance / 64.f;
+
+    if (bitmap.width > 0 && bitmap.rows > 0) {
+      ivec2 padded = glyph.size + ivec2(kPadding * 2);
+      int shelf_index;
+      if (!Allocate(padded, &shelf_index)) {
+        fprintf(stderr, "glyph is too large for the atlas\n");
+        return nullptr;
+      }
+      Shelf& shelf = shelves_[shelf_index];
+      Page& page = pages_[shelf.page];
+      ivec2 origin(shelf.x, shelf.y);
+      shelf.x += padded.x;
+      shelf.last_used = frame_;
+      shelf.keys.push_back(key);
+      page.last_used = frame_;
+
+      // copy bitmap upside down with zero padding around it.
+      for (int y = 0; y < padded.y; y++) {
+        uint8_t* row = &page.pixels[(origin.y + y) * kPageSize + origin.x];
+        std::fill(row, row + padded.x, 0);
+      }
+      for (int y = 0; y < (int)bitmap.rows; y++) {
+        const uint8_t* src = bitmap.buffer + y * bitmap.pitch;
+        uint8_t* dst = &page.pixels[(origin.y + kPadding + bitmap.rows - 1 - y) *
+                                        kPageSize +
+                                    origin.x + kPadding];
+        std::copy(src, src + bitmap.width, dst);
+      }
+      page.dirty_min_y = min(page.dirty_min_y, origin.y);
+      page.dirty_max_y = max(page.dirty_max_y, origin.y + padded.y);
+
+      glyph.page = shelf.page;
+      glyph.shelf = shelf_index;
+      glyph.pos = origin + ivec2(kPadding);
+    }
+    return &glyphs_.insert_or_assign(key, glyph).first->second;
+  }
+
+  // Allocate finds a shelf which has room for size, evicting if needed.
+  bool Allocate(ivec2 size, int* out_shelf) {
+    if (size.x > kPageSize || size.y > kPageSize) {
+      return false;
+    }
+
+    // best fit among shelves with room, wasting at most half of the height.
+    int best = FindShelf(size, size.y + size.y / 2);
+    if (best >= 0) {
+      *out_shelf = best;
+      return true;
+    }
+    if (AddShelf(size.y, out_shelf)) {
+      return true;
+    }
+    best = FindShelf(size, kPageSize);
+    if (best >= 0) {
+      *out_shelf = best;
+      return true;
+    }
+
+    // evict the least recently used shelf which is tall enough.
+    int lru = -1;
+    for (int i = 0; i < (int)shelves_.size(); i++) {
+      const Shelf& shelf = shelves_[i];
+      if (shelf.height >= size.y &&
+          (lru < 0 || shelf.last_used < shelves_[lru].last_used)) {
+        lru = i;
+      }
+    }
+    if (lru >= 0) {
+      EvictShelf(lru);
+      *out_shelf = lru;
+      return true;
+    }
+
+    // no shelf is tall enough, start over the least recently used page.
+    int lru_page = 0;
+    for (int i = 1; i < (int)pages_.size(); i++) {
+      if (pages_[i].last_used < pages_[lru_page].last_used) {
+        lru_page = i;
+      }
+    }
+    for (int i = 0; i < (int)shelves_.size(); i++) {
+      if (shelves_[i].height > 0 && shelves_[i].page == lru_page) {
+        EvictShelf(i);
+        shelves_[i].height = 0;
+      }
+    }
+    pages_[lru_page].used_height = 0;
+    return AddShelf(size.y, out_shelf);
+  }
+
+  int FindShelf(ivec2 size, int max_height) const {
+    int best = -1;
+    for (int i = 0; i < (int)shelves_.size(); i++) {
+      const Shelf& shelf = shelves_[i];
+      if (shelf.height < size.y || shelf.height > max_height ||
+          shelf.x + size.x > kPageSize) {
+        continue;
+      }
+      if (best < 0 || shelf.height < shelves_[best].height) {
+        best = i;
+      }
+    }
+    return best;
+  }
 
-  bool GetKeyState(SDL_KeyCode key_code) const {
-    auto scan_code = SDL_GetScancodeFromKey(key_code);
-    return !!key[scan_code];
+  bool AddShelf(int height, int* out_shelf) {
+    int page = -1;
+    for (int i = 0; i < (int)pages_.size(); i++) {
+      if (pages_[i].used_height + height <= kPageSize) {
+        page = i;
+        break;
+      }
+    }
+    if (page < 0) {
+      if (pages_.size() >= kMaxPages) {
+        return false;
+      }
+      pages_.push_back({std::vector<uint8_t>(kPageSize * kPageSize, 0),
+                        kPageSize, 0, 0, frame_});
+      page = pages_.size() - 1;
+    }
+
+    Shelf shelf{page, pages_[page].used_height, height, 0, frame_, {}};
+    pages_[page].used_height += height;
+
+    // reuse a slot of a shelf removed with its page.
+    for (int i = 0; i < (int)shelves_.size(); i++) {
+      if (shelves_[i].height == 0) {
+        shelves_[i] = std::move(shelf);
+        *out_shelf = i;
+        return true;
+      }
+    }
+    shelves_.push_back(std::move(shelf));
+    *out_shelf = shelves_.size() - 1;
+    return true;
+  }
+
+  void EvictShelf(int index) {
+    if (before_evict_) {
+      before_evict_();
+    }
+    Shelf& shelf = shelves_[index];
+    for (const Key& key : shelf.keys) {
+      glyphs_.erase(key);
+    }
+    shelf.keys.clear();
+    shelf.x = 0;
+  }
+};
+
+// SoftwareRenderer rasterizes primitives into a RGBA8 frame buffer on CPU.
+// Blending matches glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) on an
+// 8 bit per channel frame buffer.
+class SoftwareRenderer {
+ private:
+  ivec2 size_;
+  // top row first, RGBA byte order.
+  std::vector<uint32_t> pixels_;
+
+ public:
+  void Init(ivec2 size) {
+    size_ = size;
+    pixels_.assign(size.x * size.y, 0);
+  }
+
+  ivec2 Size() const { return size_; }
+  const uint32_t* Pixels() const { return &pixels_[0]; }
+
+  void Clear(const u8vec4& col) {
+    std::fill(pixels_.begin(), pixels_.end(), packColor(col));
+  }
+
+  // FillTriangle fills a triangle given in normalized device coordinates.
+  void FillTriangle(const vec2& p0, const vec2& p1, const vec2& p2,
+                    const u8vec4& col) {
+    if (col.a == 0) {
+      return;
+    }
+    RasterizeTriangle(ToScreen(p0), ToScreen(p1), ToScreen(p2),
+                      [&](int y, int x0, int x1) {
+                        blendSpan(Row(y) + x0, x1 - x0, col);
+                      });
+  }
+
+  // FillTexturedTriangle draws a triangle modulating col with alpha sampled
+  // bilinearly from an 8 bit texture, like the textured shader does.
+  void FillTexturedTriangle(const vec2 (&p)[3], const vec2 (&uv)[3],
+                            const uint8_t* texture, int texture_size,
+                            const u8vec4& col) {
+    vec2 s0 = ToScreen(p[0]);
+    vec2 s1 = ToScreen(p[1]);
+    vec2 s2 = ToScreen(p[2]);
+    vec2 e1 = s1 - s0;
+    vec2 e2 = s2 - s0;
+    float det = e1.x * e2.y - e1.y * e2.x;
+    if (det == 0.f) {
+      return;
+    }
+    // gradient of texel coordinates in screen space
+    vec2 t0 = uv[0] * float(texture_size);
+    vec2 t1 = uv[1] * float(texture_size) - t0;
+    vec2 t2 = uv[2] * float(texture_size) - t0;
+    vec2 dtdx = (t1 * e2.y - t2 * e1.y) / det;
+    vec2 dtdy = (t2 * e1.x - t1 * e2.x) / det;
+
+    RasterizeTriangle(s0, s1, s2, [&](int y, int x0, int x1) {
+      uint32_t* dst = Row(y);
+      for (int x = x0; x < x1; x++) {
+        vec2 t = t0 + dtdx * (x + 0.5f - s0.x) + dtdy * (y + 0.5f - s0.y);
+        int coverage = sampleBilinear(texture, texture_size, t);
+        int a = (col.a * coverage + 127) / 255;
+        if (a > 0) {
+          blendSpan(dst + x, 1, u8vec4(col.r, col.g, col.b, a));
+        }
+      }
+    });
+  }
+
+  // FillShape draws a rect or circle with border and anti-aliased edges,
+  // computing the same distance as the shape shader for each pixel.
+  void FillShape(const ShapeInstance& shape) {
+    ShapeKind kind = ShapeKind(int(shape.kind));
+    const vec2& ax = shape.axis_x;
+    const vec2& ay = shape.axis_y;
+    float det = ax.x * ay.y - ax.y * ay.x;
+    if (det == 0.f) {
+      return;
+    }
+    vec2 half_px = shapeHalfPixels(ax, ay, vec2(size_));
+    // grow the quad by a pixel to leave room for anti-aliasing
+    vec2 grow = vec2(1.f) + vec2(1.f) / half_px;
+    vec2 s[4];
+    for (int i = 0; i < 4; i++) {
+      vec2 p = kSquareVertex[i] * grow;
+      s[i] = ToScreen(ax * p.x + ay * p.y + shape.origin);
+    }
+
+    // local position of screen position is l0 + dldx * x + dldy * y
+    vec2 inv_x = vec2(ay.y, -ax.y) / det;
+    vec2 inv_y = vec2(-ay.x, ax.x) / det;
+    vec2 dndx(2.f / size_.x, 0.f);
+    vec2 dndy(0.f, -2.f / size_.y);
+    auto toLocal = [&](const vec2& ndc) {
+      return inv_x * ndc.x + inv_y * ndc.y;
+    };
+    vec2 l0 = toLocal(vec2(-1.f, 1.f) - shape.origin);
+    vec2 dldx = toLocal(dndx);
+    vec2 dldy = toLocal(dndy);
+
+    auto span = [&](int y, int x0, int x1) {
+      uint32_t* dst = Row(y);
+      vec2 l = l0 + dldx * (x0 + 0.5f) + dldy * (y + 0.5f);
+      // blend runs of pixels which are entirely fill at once
+      int fill_begin = x0;
+      for (int x = x0; x < x1; x++, l += dldx) {
+        float d = shapeDistance(kind, l, half_px);
+        if (d >= kShapeBorderWidth + 0.5f) {
+          continue;
+        }
+        blendSpan(dst + fill_begin, x - fill_begin, shape.fill);
+        fill_begin = x + 1;
+        float coverage = clamp(d + 0.5f, 0.f, 1.f);
+        float t = clamp(d - kShapeBorderWidth + 0.5f, 0.f, 1.f);
+        vec4 c = mix(vec4(shape.border), vec4(shape.fill), t);
+        c.a *= coverage;
+        blendSpan(dst + x, 1, u8vec4(c + vec4(0.5f)));
+      }
+      blendSpan(dst + fill_begin, x1 - fill_begin, shape.fill);
+    };
+    RasterizeTriangle(s[0], s[1], s[2], span);
+    RasterizeTriangle(s[2], s[1], s[3], span);
+  }
+
+  // DrawLine draws a 1 pixel wide line, including the first end point and
+  // excluding the last one like GL_LINES.
+  void DrawLine(const vec2& p0, const vec2& p1, const u8vec4& col) {
+    vec2 s0 = ToScreen(p0);
+    vec2 s1 = ToScreen(p1);
+    vec2 d = s1 - s0;
+    bool x_major = abs(d.x) >= abs(d.y);
+    float major0 = x_major ? s0.x : s0.y;
+    float major1 = x_major ? s1.x : s1.y;
+    if (major0 == major1) {
+      return;
+    }
+    float slope = x_major ? d.y / d.x : d.x / d.y;
+    float step = major1 > major0 ? 1.f : -1.f;
+    // first and last pixel centers along major axis, clipped to the
+    // framebuffer so that off screen parts are not walked.
+    int n = x_major ? size_.x : size_.y;
+    float c0 = clamp(major0 - 0.5f, -2.f, n + 1.f);
+    float c1 = clamp(major1 - 0.5f, -2.f, n + 1.f);
+    int i0 = step > 0 ? (int)ceil(c0) : (int)floor(c0);
+    int i1 = step > 0 ? (int)ceil(c1) : (int)floor(c1);
+    if (step > 0) {
+      i0 = max(i0, 0);
+      i1 = min(i1, n);
+      if (i0 >= i1) {
+        return;
+      }
+    } else {
+      i0 = min(i0, n - 1);
+      i1 = max(i1, -1);
+      if (i0 <= i1) {
+        return;
+      }
+    }
+    for (int i = i0; i != i1; i += (int)step) {
+      float minor = (x_major ? s0.y : s0.x) + (i + 0.5f - major0) * slope;
+      int j = (int)floor(minor);
+      int x = x_major ? i : j;
+      int y = x_major ? j : i;
+      if (0 <= x && x < size_.x && 0 <= y && y < size_.y) {
+        blendSpan(Row(y) + x, 1, col);
+      }
+    }
+  }
+
+ private:
+  uint32_t* Row(int y) { return &pixels_[y * size_.x]; }
+
+  vec2 ToScreen(const vec2& ndc) const {
+    return {(ndc.x + 1.f) * 0.5f * size_.x, (1.f - ndc.y) * 0.5f * size_.y};
+  }
+
+  // RasterizeTriangle calls fn(y, x0, x1) for each row of pixels whose
+  // centers are inside of the triangle. Edges shared by two triangles are
+  // owned by exactly one of them (top-left rule), so no pixel is blended
+  // twice.
+  template <typename SpanFn>
+  void RasterizeTriangle(vec2 p0, vec2 p1, vec2 p2, SpanFn fn) {
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if (area == 0.f) {
+      return;
+    }
+    if (area < 0.f) {
+      std::swap(p1, p2);
+    }
+    const vec2* edges[3][2] = {{&p0, &p1}, {&p1, &p2}, {&p2, &p0}};
+
+    float min_y = min(p0.y, min(p1.y, p2.y));
+    float max_y = max(p0.y, max(p1.y, p2.y));
+    int y0 = max(0, (int)ceil(min_y - 0.5f));
+    int y1 = min(size_.y - 1, (int)floor(max_y - 0.5f));
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      int x0 = 0;
+      int x1 = size_.x - 1;
+      for (auto& edge : edges) {
+        const vec2& a = *edge[0];
+        const vec2& b = *edge[1];
+        // inside is where (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x)
+        // is positive.
+        if (a.y == b.y) {
+          float e = (b.x - a.x) * (py - a.y);
+          // horizontal edge is included if it's a top edge.
+          if (e < 0.f || (e == 0.f && b.x < a.x)) {
+            x1 = -1;
+          }
+          continue;
+        }
+        // compute crossing from the upper vertex, so that both triangles
+        // sharing the edge get exactly the same value.
+        const vec2& s = a.y < b.y ? a : b;
+        const vec2& t = a.y < b.y ? b : a;
+        float cross_x = s.x + (t.x - s.x) * (py - s.y) / (t.y - s.y);
+        if (a.y > b.y) {
+          // left edge, inclusive
+          x0 = max(x0, (int)ceil(cross_x - 0.5f));
+        } else {
+          // right edge, exclusive
+          x1 = min(x1, (int)ceil(cross_x - 0.5f) - 1);
+        }
+      }
+      if (x0 <= x1) {
+        fn(y, x0, x1 + 1);
+      }
+    }
+  }
+
+  static uint32_t packColor(const u8vec4& col) {
+    uint8_t bytes[4] = {col.r, col.g, col.b, col.a};
+    uint32_t packed;
+    memcpy(&packed, bytes, sizeof(packed));
+    return packed;
+  }
+
+  static int sampleBilinear(const uint8_t* texture, int size, vec2 t) {
+    t -= vec2(0.5f);
+    vec2 f = floor(t);
+    vec2 w = t - f;
+    int x0 = clamp((int)f.x, 0, size - 1);
+    int y0 = clamp((int)f.y, 0, size - 1);
+    int x1 = min(x0 + 1, size - 1);
+    int y1 = min(y0 + 1, size - 1);
+    float top = mix(float(texture[y0 * size + x0]),
+                    float(texture[y0 * size + x1]), w.x);
+    float bottom = mix(float(texture[y1 * size + x0]),
+                       float(texture[y1 * size + x1]), w.x);
+    return (int)(mix(top, bottom, w.y) + 0.5f);
+  }
+
+  // blendSpan blends col over count pixels.
+  // dst = (src * a + dst * (255 - a)) / 255 for each channel, rounded.
+  static void blendSpan(uint32_t* dst, int count, const u8vec4& col) {
+    int a = col.a;
+    if (a == 0 || count <= 0) {
+      return;
+    }
+    if (a == 255) {
+      std::fill(dst, dst + count, packColor(col));
+      return;
+    }
+    uint16_t inv = 255 - a;
+    // 128 is for rounding in the division below
+    uint16_t src[4] = {
+        uint16_t(col.r * a + 128),
+        uint16_t(col.g * a + 128),
+        uint16_t(col.b * a + 128),
+        uint16_t(a * a + 128),
+    };
+    int i = 0;
+#if defined(NG_USE_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i inv16 = _mm_set1_epi16(inv);
+    const __m128i src16 = _mm_setr_epi16(src[0], src[1], src[2], src[3],
+                                         src[0], src[1], src[2], src[3]);
+    for (; i + 4 <= count; i += 4) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+      __m128i lo = _mm_unpacklo_epi8(d, zero);
+      __m128i hi = _mm_unpackhi_epi8(d, zero);
+      lo = _mm_add_epi16(_mm_mullo_epi16(lo, inv16), src16);
+      hi = _mm_add_epi16(_mm_mullo_epi16(hi, inv16), src16);
+      // x / 255 == (x + (x >> 8)) >> 8 for x in this range
+      lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+      hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                       _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < count; i++) {
+      uint8_t* p = reinterpret_cast<uint8_t*>(dst + i);
+      for (int c = 0; c < 4; c++) {
+        uint16_t v = p[c] * inv + src[c];
+        p[c] = uint8_t((v + (v >> 8)) >> 8);
+      }
+    }
+  }
+};
+
+bool savePNG(const char* path, const uint32_t* pixels, ivec2 size) {
+  SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormatFrom(
+      const_cast<uint32_t*>(pixels), size.x, size.y, 32, size.x * 4,
+      SDL_PIXELFORMAT_RGBA32);
+  if (!surface) {
+    fprintf(stderr, "ERROR: %s\n", SDL_GetError());
+    return false;
+  }
+  bool result = IMG_SavePNG(surface, path) == 0;
+  if (!result) {
+    fprintf(stderr, "Error: %s\n", IMG_GetError());
+  }
+  SDL_FreeSurface(surface);
+  return result;
+}
+
+// kActionNum is the number of ngKeyCode values.
+const int kActionNum = 256;
+
+// InputState is a snapshot of input, with a bit per ngKeyCode action.
+struct InputState {
+  std::bitset<kActionNum> actions;
+  ivec2 mouse_position = {0, 0};
+};
+
+// ActionTable maps ngKeyCode actions to a keyboard key and a mouse button.
+// Keys are resolved to scancodes when mapped, so that sampling and queries
+// don't look anything up.
+class ActionTable {
+ private:
+  struct Binding {
+    char key = 0;
+    SDL_Scancode scancode = SDL_SCANCODE_UNKNOWN;
+    uint8_t mouse_button = 0;
+  };
+
+  std::array<Binding, kActionNum> bindings_;
+  // codes which have any binding
+  std::vector<ngKeyCode> mapped_;
+
+ public:
+  void MapKeyboard(char key, ngKeyCode code) {
+    Binding& binding = bindings_[code];
+    binding.key = key;
+    binding.scancode = ResolveKey(key);
+    AddMapped(code);
+  }
+
+  void MapMouseButton(uint8_t num, ngKeyCode code) {
+    bindings_[code].mouse_button = num;
+    AddMapped(code);
+  }
+
+  // Resolve resolves keys mapped before SDL video was initialized, or
+  // again after the keyboard layout changed.
+  void Resolve() {
+    for (ngKeyCode code : mapped_) {
+      bindings_[code].scancode = ResolveKey(bindings_[code].key);
+    }
+  }
+
+  // ForEachKeyAction calls fn(code) for each action mapped to scancode.
+  template <typename F>
+  void ForEachKeyAction(SDL_Scancode scancode, F fn) const {
+    // actions without a key have SDL_SCANCODE_UNKNOWN
+    if (scancode == SDL_SCANCODE_UNKNOWN) {
+      return;
+    }
+    for (ngKeyCode code : mapped_) {
+      if (bindings_[code].scancode == scancode) {
+        fn(code);
+      }
+    }
+  }
+
+  // ForEachMouseAction calls fn(code) for each action mapped to button.
+  template <typename F>
+  void ForEachMouseAction(uint8_t button, F fn) const {
+    for (ngKeyCode code : mapped_) {
+      if (bindings_[code].mouse_button == button) {
+        fn(code);
+      }
+    }
+  }
+
+  // Sample returns a bit for each action which is pressed in key_state of
+  // num_keys scancodes or mouse_buttons mask.
+  std::bitset<kActionNum> Sample(const Uint8* key_state, int num_keys,
+                                 Uint32 mouse_buttons) const {
+    std::bitset<kActionNum> actions;
+    for (ngKeyCode code : mapped_) {
+      const Binding& binding = bindings_[code];
+      bool pressed = binding.scancode != SDL_SCANCODE_UNKNOWN &&
+                     binding.scancode < num_keys &&
+                     key_state[binding.scancode];
+      pressed |= binding.mouse_button != 0 &&
+                 (mouse_buttons & SDL_BUTTON(binding.mouse_button));
+      actions[code] = pressed;
+    }
+    return actions;
+  }
+
+ private:
+  static SDL_Scancode ResolveKey(char key) {
+    if (key == 0 || !SDL_WasInit(SDL_INIT_VIDEO)) {
+      return SDL_SCANCODE_UNKNOWN;
+    }
+    return SDL_GetScancodeFromKey(SDL_KeyCode(key));
+  }
+
+  void AddMapped(ngKeyCode code) {
+    if (std::find(mapped_.begin(), mapped_.end(), code) == mapped_.end()) {
+      mapped_.push_back(code);
+    }
+  }
+};
+
+// Input log is a binary log of input and delta time of each frame, in host
+// byte order.
+//   header: magic "ngIL", uint32 version
+//   frame:  double dt, uint8 flags,
+//           uint16 n and n uint8 codes of toggled actions if kActionsChanged,
+//           int32 x and y of cursor if kCursorMoved,
+//           uint16 n and n events of uint8 code, uint8 pressed and
+//           double time if kHasEvents.
+const char kInputLogMagic[4] = {'n', 'g', 'I', 'L'};
+const uint32_t kInputLogVersion = 1;
+
+enum InputLogFlag : uint8_t {
+  kActionsChanged = 1 << 0,
+  kCursorMoved = 1 << 1,
+  kHasEvents = 1 << 2,
+};
+
+class InputLogWriter {
+ private:
+  FILE* file_ = nullptr;
+  InputState prev_;
+
+ public:
+  ~InputLogWriter() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+
+  bool Open(const char* path) {
+    file_ = fopen(path, "wb");
+    if (!file_) {
+      fprintf(stderr, "failed to open %s\n", path);
+      return false;
+    }
+    fwrite(kInputLogMagic, sizeof(kInputLogMagic), 1, file_);
+    Put(kInputLogVersion);
+    return true;
+  }
+
+  void Write(double dt, const InputState& state, const ngInputEvent* events,
+             size_t event_num) {
+    std::bitset<kActionNum> toggled = state.actions ^ prev_.actions;
+    uint8_t flags = 0;
+    flags |= toggled.any() ? kActionsChanged : 0;
+    flags |= state.mouse_position != prev_.mouse_position ? kCursorMoved : 0;
+    flags |= event_num > 0 ? kHasEvents : 0;
+    Put(dt);
+    Put(flags);
+    if (flags & kActionsChanged) {
+      Put(uint16_t(toggled.count()));
+      for (int code = 0; code < kActionNum; code++) {
+        if (toggled[code]) {
+          Put(uint8_t(code));
+        }
+      }
+    }
+    if (flags & kCursorMoved) {
+      Put(int32_t(state.mouse_position.x));
+      Put(int32_t(state.mouse_position.y));
+    }
+    if (flags & kHasEvents) {
+      Put(uint16_t(event_num));
+      for (size_t i = 0; i < event_num; i++) {
+        Put(uint8_t(events[i].code));
+        Put(uint8_t(events[i].pressed));
+        Put(events[i].time);
+      }
+    }
+    prev_ = state;
+  }
+
+ private:
+  template <typename T>
+  void Put(const T& v) {
+    fwrite(&v, sizeof(v), 1, file_);
+  }
+};
+
+class InputLogReader {
+ private:
+  FILE* file_ = nullptr;
+  InputState state_;
+
+ public:
+  ~InputLogReader() {
+    if (file_) {
+      fclose(file_);
+    }
+  }
+
+  bool Open(const char* path) {
+    file_ = fopen(path, "rb");
+    if (!file_) {
+      fprintf(stderr, "failed to open %s\n", path);
+      return false;
+    }
+    char magic[sizeof(kInputLogMagic)];
+    uint32_t version;
+    if (fread(magic, sizeof(magic), 1, file_) != 1 ||
+        memcmp(magic, kInputLogMagic, sizeof(magic)) != 0 || !Get(&version) ||
+        version != kInputLogVersion) {
+      fprintf(stderr, "%s is not an input log of version %u\n", path,
+              kInputLogVersion);
+      return false;
+    }
+    return true;
+  }
+
+  // Read reads the next frame. It returns false at the end of the log.
+  bool Read(double* dt, InputState* state, std::vector<ngInputEvent>* events) {
+    uint8_t flags;
+    if (!Get(dt) || !Get(&flags)) {
+      return false;
+    }
+    if (flags & kActionsChanged) {
+      uint16_t n;
+      if (!Get(&n)) {
+        return false;
+      }
+      for (int i = 0; i < n; i++) {
+        uint8_t code;
+        if (!Get(&code)) {
+          return false;
+        }
+        state_.actions.flip(code);
+      }
+    }
+    if (flags & kCursorMoved) {
+      int32_t x, y;
+      if (!Get(&x) || !Get(&y)) {
+        return false;
+      }
+      state_.mouse_position = {x, y};
+    }
+    events->clear();
+    if (flags & kHasEvents) {
+      uint16_t n;
+      if (!Get(&n)) {
+        return false;
+      }
+      for (int i = 0; i < n; i++) {
+        uint8_t code, pressed;
+        double time;
+        if (!Get(&code) || !Get(&pressed) || !Get(&time)) {
+          return false;
+        }
+        events->push_back({code, !!pressed, time});
+      }
+    }
+    *state = state_;
+    return true;
+  }
+
+ private:
+  template <typename T>
+  bool Get(T* v) {
+    return fread(v, sizeof(*v), 1, file_) == 1;
+  }
+};
+
+}  // namespace
+
+void ngProfiler::BeginZone(const char* name) {
+  threadProfileRing().Push(name, SDL_GetPerformanceCounter());
+}
+
+void ngProfiler::EndZone() {
+  threadProfileRing().Push(nullptr, SDL_GetPerformanceCounter());
+}
+
+bool ngProfiler::ExportChromeTrace(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    fprintf(stderr, "failed to open %s\n", path);
+    return false;
+  }
+
+  double usec_per_tick = 1000000.0 / double(SDL_GetPerformanceFrequency());
+  std::vector<ProfileEvent> events;
+  bool first = true;
+  fprintf(file, "{\"traceEvents\":[\n");
+  ProfileRegistry::Get().ForEachRing([&](const ProfileRing& ring) {
+    ring.Read(&events);
+    for (const ProfileEvent& event : events) {
+      std::string line = fmt::format(
+          "{0}{{\"name\":\"{1}\",\"ph\":\"{2}\",\"ts\":{3:.3f},"
+          "\"pid\":1,\"tid\":{4}}}",
+          first ? "" : ",\n", event.name ? escapeJSON(event.name) : "",
+          event.name ? "B" : "E", event.tick * usec_per_tick,
+          ring.ThreadId());
+      fputs(line.c_str(), file);
+      first = false;
+    }
+  });
+  fprintf(file, "\n]}\n");
+
+  bool ok = ferror(file) == 0;
+  if (fclose(file) != 0 || !ok) {
+    fprintf(stderr, "failed to write %s\n", path);
+    return false;
+  }
+  return true;
+}
+
+glm::mat3 ngMath::TRS(vec2 pos, float rad, vec2 s) {
+  return scale(rotate(translate(mat3(1.f), pos), rad), s);
+}
+
+bool ngMath::SweepRect(const ngRect& moving, vec2 delta,
+                       const ngRect& target, ngSweepHit* hit) {
+  // sweep the center of moving as a point against target grown by the size
+  // of moving.
+  vec2 half = moving.size + target.size;
+  vec2 diff = moving.pos - target.pos;
+  vec2 enter, leave;
+  for (int axis = 0; axis < 2; axis++) {
+    if (delta[axis] == 0.f) {
+      if (abs(diff[axis]) >= half[axis]) {
+        return false;
+      }
+      enter[axis] = -FLT_MAX;
+      leave[axis] = FLT_MAX;
+    } else {
+      float t1 = (-half[axis] - diff[axis]) / delta[axis];
+      float t2 = (half[axis] - diff[axis]) / delta[axis];
+      enter[axis] = min(t1, t2);
+      leave[axis] = max(t1, t2);
+    }
+  }
+  float enter_time = max(enter.x, enter.y);
+  float leave_time = min(leave.x, leave.y);
+  // only touching at the end of the move is not a collision.
+  if (enter_time >= leave_time || enter_time >= 1.f || leave_time <= 0.f) {
+    return false;
+  }
+
+  if (enter_time < 0.f) {
+    vec2 depth = half - abs(diff);
+    int axis = depth.x < depth.y ? 0 : 1;
+    hit->time = 0.f;
+    hit->normal = vec2(0.f);
+    hit->normal[axis] = diff[axis] >= 0.f ? 1.f : -1.f;
+    return true;
+  }
+  hit->time = enter_time;
+  hit->normal = vec2(0.f);
+  if (enter.x >= enter.y) {
+    hit->normal.x = delta.x > 0.f ? -1.f : 1.f;
+  }
+  if (enter.y >= enter.x) {
+    hit->normal.y = delta.y > 0.f ? -1.f : 1.f;
+  }
+  // hitting a corner exactly
+  hit->normal = normalize(hit->normal);
+  return true;
+}
+
+vec2 ngMath::ResolveSweep(ngRect* r, vec2 delta, const ngSweepHit& hit,
+                          float bounce, vec2* velocity) {
+  r->pos += delta * hit.time;
+  vec2 rest = delta * (1.f - hit.time);
+  float v = dot(*velocity, hit.normal);
+  if (v < 0.f) {
+    *velocity -= (1.f + bounce) * v * hit.normal;
+  }
+  float d = dot(rest, hit.normal);
+  if (d < 0.f) {
+    rest -= (1.f + bounce) * d * hit.normal;
+  }
+  return rest;
+}
+
+namespace {
+
+// must be a power of two
+const int kCollisionBucketNum = 4096;
+
+}  // namespace
+
+ngCollisionWorld::ngCollisionWorld(float cell_size)
+    : inv_cell_size_(1.f / cell_size),
+      buckets_(kCollisionBucketNum),
+      occupied_index_(kCollisionBucketNum, -1) {}
+
+ngColliderId ngCollisionWorld::Add(const ngRect& rect, uint32_t layers) {
+  ngColliderId id;
+  if (free_ids_.empty()) {
+    id = colliders_.size();
+    colliders_.emplace_back();
+    visit_mark_.push_back(0);
+  } else {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+  }
+  Collider& c = colliders_[id];
+  c.rect = rect;
+  c.layers = layers;
+  c.cell_min = CellOf({rect.Left(), rect.Bottom()});
+  c.cell_max = CellOf({rect.Right(), rect.Top()});
+  c.alive = true;
+  Link(id);
+  return id;
+}
+
+void ngCollisionWorld::Move(ngColliderId id, const ngRect& rect) {
+  Collider& c = colliders_[id];
+  NG_ASSERT(c.alive);
+  c.rect = rect;
+  ivec2 cell_min = CellOf({rect.Left(), rect.Bottom()});
+  ivec2 cell_max = CellOf({rect.Right(), rect.Top()});
+  if (cell_min == c.cell_min && cell_max == c.cell_max) {
+    return;
+  }
+  Unlink(id);
+  c.cell_min = cell_min;
+  c.cell_max = cell_max;
+  Link(id);
+}
+
+void ngCollisionWorld::Remove(ngColliderId id) {
+  NG_ASSERT(colliders_[id].alive);
+  Unlink(id);
+  colliders_[id].alive = false;
+  free_ids_.push_back(id);
+}
+
+void ngCollisionWorld::Clear() {
+  for (int b : occupied_) {
+    buckets_[b].clear();
+    occupied_index_[b] = -1;
+  }
+  occupied_.clear();
+  colliders_.clear();
+  free_ids_.clear();
+  visit_mark_.clear();
+  visit_ = 0;
+}
+
+void ngCollisionWorld::Query(const ngRect& rect, uint32_t layers,
+                             std::vector<ngColliderId>* out) const {
+  if (++visit_ == 0) {
+    std::fill(visit_mark_.begin(), visit_mark_.end(), 0);
+    visit_ = 1;
+  }
+  ivec2 cell_min = CellOf({rect.Left(), rect.Bottom()});
+  ivec2 cell_max = CellOf({rect.Right(), rect.Top()});
+  for (int y = cell_min.y; y <= cell_max.y; y++) {
+    for (int x = cell_min.x; x <= cell_max.x; x++) {
+      for (ngColliderId id : buckets_[BucketOf({x, y})]) {
+        if (visit_mark_[id] == visit_) {
+          continue;
+        }
+        visit_mark_[id] = visit_;
+        const Collider& c = colliders_[id];
+        if ((c.layers & layers) && ngMath::IsCollideRect(c.rect, rect)) {
+          out->push_back(id);
+        }
+      }
+    }
+  }
+}
+
+void ngCollisionWorld::QueryPairs(uint32_t layers_a, uint32_t layers_b,
+                                  std::vector<ngColliderPair>* out) const {
+  for (int b : occupied_) {
+    const std::vector<ngColliderId>& bucket = buckets_[b];
+    for (size_t i = 0; i < bucket.size(); i++) {
+      const Collider& c1 = colliders_[bucket[i]];
+      for (size_t j = i + 1; j < bucket.size(); j++) {
+        const Collider& c2 = colliders_[bucket[j]];
+        bool forward = (c1.layers & layers_a) && (c2.layers & layers_b);
+        bool backward = (c2.layers & layers_a) && (c1.layers & layers_b);
+        if (!(forward || backward) || !ngMath::IsCollideRect(c1.rect, c2.rect)) {
+          continue;
+        }
+        // a pair shares several cells when both are large, so it is only
+        // reported from the cell at the bottom left of the overlap.
+        vec2 corner(max(c1.rect.Left(), c2.rect.Left()),
+                    max(c1.rect.Bottom(), c2.rect.Bottom()));
+        if (BucketOf(CellOf(corner)) != b) {
+          continue;
+        }
+        if (forward) {
+          out->push_back({bucket[i], bucket[j]});
+        } else {
+          out->push_back({bucket[j], bucket[i]});
+        }
+      }
+    }
+  }
+}
+
+ivec2 ngCollisionWorld::CellOf(vec2 pos) const {
+  return ivec2(floor(pos * inv_cell_size_));
+}
+
+int ngCollisionWorld::BucketOf(ivec2 cell) const {
+  uint32_t h = uint32_t(cell.x) * 73856093u ^ uint32_t(cell.y) * 19349663u;
+  return h & (kCollisionBucketNum - 1);
+}
+
+void ngCollisionWorld::Link(ngColliderId id) {
+  const Collider& c = colliders_[id];
+  bool single = c.cell_min == c.cell_max;
+  for (int y = c.cell_min.y; y <= c.cell_max.y; y++) {
+    for (int x = c.cell_min.x; x <= c.cell_max.x; x++) {
+      int b = BucketOf({x, y});
+      const std::vector<ngColliderId>& bucket = buckets_[b];
+      // cells of a large rect may share a bucket
+      if (single || std::find(bucket.begin(), bucket.end(), id) ==
+                        bucket.end()) {
+        AddToBucket(b, id);
+      }
+    }
+  }
+}
+
+void ngCollisionWorld::Unlink(ngColliderId id) {
+  const Collider& c = colliders_[id];
+  for (int y = c.cell_min.y; y <= c.cell_max.y; y++) {
+    for (int x = c.cell_min.x; x <= c.cell_max.x; x++) {
+      int b = BucketOf({x, y});
+      std::vector<ngColliderId>& bucket = buckets_[b];
+      auto it = std::find(bucket.begin(), bucket.end(), id);
+      if (it == bucket.end()) {
+        continue;
+      }
+      *it = bucket.back();
+      bucket.pop_back();
+      if (bucket.empty()) {
+        // move the last occupied bucket to the place of b
+        int last = occupied_.back();
+        occupied_[occupied_index_[b]] = last;
+        occupied_index_[last] = occupied_index_[b];
+        occupied_.pop_back();
+        occupied_index_[b] = -1;
+      }
+    }
+  }
+}
+
+void ngCollisionWorld::AddToBucket(int b, ngColliderId id) {
+  std::vector<ngColliderId>& bucket = buckets_[b];
+  if (bucket.empty()) {
+    occupied_index_[b] = int(occupied_.size());
+    occupied_.push_back(b);
+  }
+  bucket.push_back(id);
+}
+
+namespace {
+
+// collideBlock returns bit i set if rect (l, r, b, t) collides with rect i of
+// rects from first, for up to 64 rects.
+uint64_t collideBlock(float l, float r, float b, float t,
+                      const ngRectSoA& rects, size_t first, size_t n) {
+  const float* left = rects.left.data() + first;
+  const float* right = rects.right.data() + first;
+  const float* bottom = rects.bottom.data() + first;
+  const float* top = rects.top.data() + first;
+  uint64_t hits = 0;
+  size_t i = 0;
+#if defined(NG_USE_AVX2)
+  __m256 vl = _mm256_set1_ps(l), vr = _mm256_set1_ps(r);
+  __m256 vb = _mm256_set1_ps(b), vt = _mm256_set1_ps(t);
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_and_ps(
+        _mm256_cmp_ps(vr, _mm256_loadu_ps(left + i), _CMP_GT_OQ),
+        _mm256_cmp_ps(vl, _mm256_loadu_ps(right + i), _CMP_LT_OQ));
+    __m256 y = _mm256_and_ps(
+        _mm256_cmp_ps(vt, _mm256_loadu_ps(bottom + i), _CMP_GT_OQ),
+        _mm256_cmp_ps(vb, _mm256_loadu_ps(top + i), _CMP_LT_OQ));
+    hits |= uint64_t(_mm256_movemask_ps(_mm256_and_ps(x, y))) << i;
+  }
+#elif defined(NG_USE_SSE2)
+  __m128 vl = _mm_set1_ps(l), vr = _mm_set1_ps(r);
+  __m128 vb = _mm_set1_ps(b), vt = _mm_set1_ps(t);
+  for (; i + 4 <= n; i += 4) {
+    __m128 x = _mm_and_ps(_mm_cmpgt_ps(vr, _mm_loadu_ps(left + i)),
+                          _mm_cmplt_ps(vl, _mm_loadu_ps(right + i)));
+    __m128 y = _mm_and_ps(_mm_cmpgt_ps(vt, _mm_loadu_ps(bottom + i)),
+                          _mm_cmplt_ps(vb, _mm_loadu_ps(top + i)));
+    hits |= uint64_t(_mm_movemask_ps(_mm_and_ps(x, y))) << i;
+  }
+#endif
+  for (; i < n; i++) {
+    bool hit = r > left[i] && l < right[i] && t > bottom[i] && b < top[i];
+    hits |= uint64_t(hit) << i;
+  }
+  return hits;
+}
+
+// rects of bs tested against each rect of as at once, small enough for the
+// edges to stay in L1 cache.
+const size_t kCollideTile = 1024;
+
+}  // namespace
+
+void ngMath::CollideRects(const ngRect& r, const ngRectSoA& rects,
+                          uint64_t* hits) {
+  float left = r.Left(), right = r.Right(), bottom = r.Bottom(), top = r.Top();
+  for (size_t i = 0; i < rects.Size(); i += 64) {
+    size_t n = min(rects.Size() - i, size_t(64));
+    hits[i / 64] = collideBlock(left, right, bottom, top, rects, i, n);
+  }
+}
+
+void ngMath::CollideRects(const ngRectSoA& as, const ngRectSoA& bs,
+                          uint64_t* hits) {
+  size_t words = (bs.Size() + 63) / 64;
+  for (size_t tile = 0; tile < bs.Size(); tile += kCollideTile) {
+    size_t tile_end = min(bs.Size(), tile + kCollideTile);
+    for (size_t a = 0; a < as.Size(); a++) {
+      uint64_t* row = hits + a * words;
+      for (size_t i = tile; i < tile_end; i += 64) {
+        size_t n = min(tile_end - i, size_t(64));
+        row[i / 64] = collideBlock(as.left[a], as.right[a], as.bottom[a],
+                                   as.top[a], bs, i, n);
+      }
+    }
+  }
+}
+
+namespace {
+
+uint32_t packColor(const ngColor& col) {
+  return (col.r & 0xff) | (col.g & 0xff) << 8 | (col.b & 0xff) << 16 |
+         (col.a & 0xff) << 24;
+}
+
+ngColor unpackColor(uint32_t col) {
+  return ngColor(col & 0xff, (col >> 8) & 0xff, (col >> 16) & 0xff,
+                 col >> 24);
+}
+
+bool isSameTransform(const ngAffine2D& a, const ngAffine2D& b) {
+  return a.x_axis == b.x_axis && a.y_axis == b.y_axis && a.origin == b.origin;
+}
+
+// DrawRef is a command of a list given to ngProcess::SubmitDrawLists.
+struct DrawRef {
+  const ngDrawList* list;
+  const ngDrawList::Command* command;
+};
+
+}  // namespace
+
+void ngDrawList::Clear() {
+  layer_ = 0;
+  stack_.clear();
+  stack_.push_back(ngAffine2D());
+  transform_ = kNoTransform;
+  transforms_.clear();
+  commands_.clear();
+  text_.clear();
+}
+
+ngDrawList::Command& ngDrawList::Add(Kind kind) {
+  commands_.emplace_back();
+  Command& c = commands_.back();
+  c.kind = kind;
+  c.layer = layer_;
+  // commands between pushes and pops share a transform.
+  if (transform_ == kNoTransform) {
+    transform_ = uint32_t(transforms_.size());
+    transforms_.push_back(stack_.back());
+  }
+  c.transform = transform_;
+  c.extra = 0;
+  c.b = vec2(0.f);
+  return c;
+}
+
+void ngDrawList::Rect(const ngColor& border, const ngColor& fill,
+                      const vec2& center, const vec2& size) {
+  Command& c = Add(Kind::RECT);
+  c.color = packColor(border);
+  c.extra = packColor(fill);
+  c.a = center;
+  c.b = size;
+}
+
+void ngDrawList::Line(const ngColor& col, const vec2& pos1,
+                      const vec2& pos2) {
+  Command& c = Add(Kind::LINE);
+  c.color = packColor(col);
+  c.a = pos1;
+  c.b = pos2;
+}
+
+void ngDrawList::Circle(const ngColor& border, const ngColor& fill,
+                        const ngCoord& center, float length) {
+  Command& c = Add(Kind::CIRCLE);
+  c.color = packColor(border);
+  c.extra = packColor(fill);
+  c.a = center;
+  c.b = vec2(length, 0.f);
+}
+
+void ngDrawList::Text(const ngColor& col, const ngCoord& pos, float length,
+                      const char* str) {
+  Command& c = Add(Kind::TEXT);
+  c.color = packColor(col);
+  c.a = pos;
+  c.b = vec2(length, 0.f);
+  c.extra = uint32_t(text_.size());
+  text_.insert(text_.end(), str, str + strlen(str) + 1);
+}
+
+void ngDrawList::Append(const ngDrawList& other) {
+  uint32_t transform_offset = uint32_t(transforms_.size());
+  uint32_t text_offset = uint32_t(text_.size());
+  for (Command c : other.commands_) {
+    c.transform += transform_offset;
+    if (c.kind == Kind::TEXT) {
+      c.extra += text_offset;
+    }
+    commands_.push_back(c);
+  }
+  transforms_.insert(transforms_.end(), other.transforms_.begin(),
+                     other.transforms_.end());
+  text_.insert(text_.end(), other.text_.begin(), other.text_.end());
+}
+
+// ngProcessBase implements the parts of ngProcess shared by all backends:
+// transform stack, text layout, input mapping and the main loop.
+class ngProcessBase : public ngProcess {
+ protected:
+  static const int kGlyphPixelSize = 64;
+
+  vec2 window_size_;
+  // reserved once, as pushing happens for every transformed group of draws
+  static const size_t kTransStackReserve = 64;
+  std::vector<ngAffine2D> trans_stack_;
+
+  GlyphCache glyph_cache_;
+  FT_Library library_;
+  FT_Face face_;
+
+  InputState current_state_;
+  InputState prev_state_;
+  // cursor for drawing, sampled again before the renderer in the low
+  // latency mode. It is not recorded, and updates never see it.
+  ivec2 draw_cursor_ = {0, 0};
+  ActionTable action_table_;
+  // events since the previous update, and counts of them per action
+  std::vector<ngInputEvent> input_events_;
+  std::array<int, kActionNum> press_count_ = {};
+  std::array<int, kActionNum> release_count_ = {};
+
+  TickCounter tick_counter_;
+  FrameProfiler profiler_;
+  bool show_stats_ = false;
+  std::string trace_path_;
+  int trace_export_code_ = -1;
+
+  ngUpdater updater_;
+  ngRenderer render_callback_;
+
+  bool low_latency_ = false;
+  int max_queued_frames_ = -1;
+  LatencyPacer latency_pacer_;
+
+  std::unique_ptr<InputLogWriter> input_recorder_;
+  std::unique_ptr<InputLogReader> input_replayer_;
+  std::vector<ngInputEvent> replay_events_;
+  uint64_t replay_begin_ = 0;
+  int replay_frames_ = 0;
+
+  // fixed timestep is disabled if fixed_step_ is 0.
+  double fixed_step_ = 0.0;
+  int max_steps_ = 0;
+  double accumulator_ = 0.0;
+
+  // RunRecorded records to draw_lists_[record_index_]. With pipelining, the
+  // other one is the list of the previous frame being drawn.
+  ngDrawList draw_lists_[2];
+  int record_index_ = 0;
+  bool pipelined_ = false;
+  // written by the worker, and read after waiting for it
+  int worker_steps_ = 0;
+  float worker_alpha_ = 1.f;
+  // alpha of the list drawn with pipelining
+  float drawn_alpha_ = 1.f;
+#if !defined(__EMSCRIPTEN__)
+  FrameWorker update_worker_;
+#endif
+  // commands of SubmitDrawLists in drawing order
+  std::vector<DrawRef> draw_order_;
+
+  bool exit_;
+
+  // InitCommon initializes resources which don't depend on the backend.
+  bool InitCommon();
+
+  // PushInputEvent queues a press or release of code for the next update.
+  void PushInputEvent(ngKeyCode code, bool pressed, double time) {
+    input_events_.push_back({code, pressed, time});
+    (pressed ? press_count_ : release_count_)[code]++;
+  }
+
+  // ProcessEvents handles pending platform events.
+  virtual void ProcessEvents() = 0;
+  // SampleInput returns input state of this frame.
+  virtual InputState SampleInput() = 0;
+  // SampleCursor returns the cursor position now.
+  virtual ivec2 SampleCursor() { return current_state_.mouse_position; }
+  // DeltaTime returns seconds elapsed since previous frame.
+  virtual double DeltaTime() { return tick_counter_.ElapsedSec(); }
+  // BeginFrame is called before the updater.
+  virtual void BeginFrame() = 0;
+  // Submit sends drawing of this frame, and Present shows it.
+  virtual void Submit() = 0;
+  virtual void Present() = 0;
+  // DrawGlyph draws a transformed glyph quad whose corners are ordered as a
+  // triangle strip.
+  virtual void DrawGlyph(const GlyphCache::Glyph& glyph, const vec2 (&quad)[4],
+                         const vec2& uv0, const vec2& uv1,
+                         const u8vec4& color) = 0;
+
+ public:
+  void Run(ngUpdater updater) override;
+  void Run(ngUpdater updater, ngRenderer renderer) override;
+  void RunRecorded(ngRecorder recorder, bool pipelined) override;
+  void SubmitDrawLists(const ngDrawList* const* lists, size_t n) override;
+  void SetFixedTimestep(float step, int max_steps) override;
+  void SetLowLatencyMode(bool enable, int max_queued_frames) override;
+  bool StartRecording(const char* path) override;
+  bool StartReplay(const char* path) override;
+  void ExitLoop() override;
+
+  const ngFrameStats& FrameStats() override { return profiler_.Stats(); }
+  void ShowStatsOverlay(bool show) override { show_stats_ = show; }
+  void SetTraceFile(const char* path) override { trace_path_ = path; }
+  void MapTraceExport(ngKeyCode code) override { trace_export_code_ = code; }
+  void Push(const mat3& mat) override;
+  void Push(const ngAffine2D& t) override;
+  void Pop() override;
+
+  void Square(const ngColor& border, const ngColor& fill, const vec2& center,
+              const float size) override {
+    Rect(border, fill, center, {size, size});
+  }
+
+  void Text(const ngColor& col, const ngCoord& pos, float length,
+            const char* str) override {
+    NG_PROFILE_ZONE("ngProcess::Text");
+    float scale = length / kGlyphPixelSize;
+    ngAffine2D m = trans_stack_.back().TranslateScaled(pos, {scale, scale});
+    u8vec4 col_u8 = color256ToU8(col);
+
+    uint32_t codepoint;
+    uint32_t state = 0;
+    float x_advance = 0.f;
+    for (; *str; ++str) {
+      if (!utf8decode(&state, &codepoint, *str)) {
+        const GlyphCache::Glyph* glyph =
+            glyph_cache_.Get(face_, codepoint, kGlyphPixelSize);
+        if (!glyph) {
+          return;
+        }
+        if (glyph->page >= 0) {
+          vec2 origin = glyph->bearing + vec2(x_advance, 0.f);
+          vec2 right = {glyph->extent.x, 0};
+          vec2 up = {0, glyph->extent.y};
+          vec2 quad[4] = {
+              m.Apply(origin),
+              m.Apply(origin + up),
+              m.Apply(origin + right),
+              m.Apply(origin + right + up),
+          };
+          vec2 uv0 = vec2(glyph->pos) / float(GlyphCache::kPageSize);
+          vec2 uv1 =
+              vec2(glyph->pos + glyph->size) / float(GlyphCache::kPageSize);
+          DrawGlyph(*glyph, quad, uv0, uv1, col_u8);
+        }
+        x_advance += glyph->advance;
+      }
+    }
+  }
+
+  void MapKeyboard(char key, ngKeyCode code) override {
+    action_table_.MapKeyboard(key, code);
+  }
+
+  void MapMouseButton(uint8_t num, ngKeyCode code) override {
+    action_table_.MapMouseButton(num, code);
+  }
+
+  // void MapPadButton(uint8_t padIndex, uint8_t buttonIndex,
+  //                  ngKeyCode code) override {
+  //  throw std::logic_error("The method or operation is not implemented.");
+  //}
+
+  bool IsHold(ngKeyCode code) override {
+    return current_state_.actions[code];
+  }
+
+  bool IsJustPressed(ngKeyCode code) override {
+    return (current_state_.actions[code] && !prev_state_.actions[code]) ||
+           press_count_[code] > 0;
+  }
+
+  bool IsJustReleased(ngKeyCode code) override {
+    return (!current_state_.actions[code] && prev_state_.actions[code]) ||
+           release_count_[code] > 0;
+  }
+
+  int PressCount(ngKeyCode code) override {
+    if (press_count_[code] > 0) {
+      return press_count_[code];
+    }
+    return current_state_.actions[code] && !prev_state_.actions[code];
+  }
+
+  const std::vector<ngInputEvent>& InputEvents() override {
+    return input_events_;
+  }
+
+  ngCoord CursorPos() override {
+    return ngCoord(current_state_.mouse_position);
+  }
+  ngCoord DrawCursorPos() override { return ngCoord(draw_cursor_); }
+
+  void Tick();
+
+ private:
+  float UpdateSteps(double dt, int* steps);
+  void Update(float dt);
+  bool ReplayInput(size_t event_begin, double* dt);
+  void DrawStatsOverlay();
+  void ExportTrace();
+};
+
+bool ngProcessBase::InitCommon() {
+  exit_ = false;
+
+  window_size_ = vec2(320, 240);
+  trans_stack_.reserve(kTransStackReserve);
+
+  if (FT_Init_FreeType(&library_) != 0) {
+    fprintf(stderr, "failed to FT_Init_FreeType\n");
+    return false;
+  }
+
+  const char* kFontFilePath = "asset/font/NotoSansJP-Regular.otf";
+  if (FT_New_Face(library_, kFontFilePath, 0, &face_) != 0) {
+    fprintf(stderr, "failed to FT_New_Face\n");
+    return false;
+  }
+
+  if (FT_Set_Pixel_Sizes(face_, 0, kGlyphPixelSize) != 0) {
+    fprintf(stderr, "failed to FT_Set_Pixel_Sizes\n");
+    return false;
+  }
+
+  tick_counter_.Reset();
+  profiler_.Reset();
+  input_events_.reserve(64);
+
+  return true;
+}
+
+#if defined(__EMSCRIPTEN__)
+void esMainLoop(void* arg) {
+  auto* proc = reinterpret_cast<ngProcessBase*>(arg);
+  proc->Tick();
+}
+
+#endif
+
+void ngProcessBase::Run(ngUpdater updater) { Run(updater, nullptr); }
+
+void ngProcessBase::Run(ngUpdater updater, ngRenderer renderer) {
+  updater_ = updater;
+  render_callback_ = renderer;
+  accumulator_ = 0.0;
+#if defined(__EMSCRIPTEN__)
+  emscripten_set_main_loop_arg(esMainLoop, this, 0, true);
+#else
+  while (!exit_) {
+    Tick();
+  }
+  ExportTrace();
+#endif
+}
+
+void ngProcessBase::RunRecorded(ngRecorder recorder, bool pipelined) {
+#if defined(__EMSCRIPTEN__)
+  pipelined = false;
+#endif
+  pipelined_ = pipelined;
+  record_index_ = 0;
+  drawn_alpha_ = 1.f;
+  for (ngDrawList& list : draw_lists_) {
+    list.Clear();
+  }
+  // only the last update of a frame is drawn with fixed timestep, and lists
+  // are not interpolated by alpha.
+  ngUpdater updater = [this, recorder](ngProcess& p, float dt) {
+    ngDrawList& list = draw_lists_[record_index_];
+    list.Clear();
+    recorder(p, dt, list);
+  };
+  ngRenderer renderer = [this](ngProcess&, float) {
+    const ngDrawList* list =
+        &draw_lists_[pipelined_ ? 1 - record_index_ : record_index_];
+    SubmitDrawLists(&list, 1);
+  };
+  Run(updater, renderer);
+  pipelined_ = false;
+}
+
+void ngProcessBase::SubmitDrawLists(const ngDrawList* const* lists,
+                                    size_t n) {
+  NG_PROFILE_ZONE("ngProcess::SubmitDrawLists");
+  draw_order_.clear();
+  for (size_t i = 0; i < n; i++) {
+    for (const ngDrawList::Command& command : lists[i]->Commands()) {
+      draw_order_.push_back({lists[i], &command});
+    }
+  }
+  std::stable_sort(draw_order_.begin(), draw_order_.end(),
+                   [](const DrawRef& a, const DrawRef& b) {
+                     return a.command->layer < b.command->layer;
+                   });
+
+  // push only when the transform of commands changes.
+  const ngAffine2D* pushed = nullptr;
+  for (const DrawRef& ref : draw_order_) {
+    const ngDrawList::Command& c = *ref.command;
+    const ngAffine2D& transform = ref.list->Transforms()[c.transform];
+    if (!pushed || !isSameTransform(*pushed, transform)) {
+      if (pushed) {
+        Pop();
+      }
+      Push(transform);
+      pushed = &transform;
+    }
+    switch (c.kind) {
+      case ngDrawList::Kind::RECT:
+        Rect(unpackColor(c.color), unpackColor(c.extra), c.a, c.b);
+        break;
+      case ngDrawList::Kind::CIRCLE:
+        Circle(unpackColor(c.color), unpackColor(c.extra), c.a, c.b.x);
+        break;
+      case ngDrawList::Kind::LINE:
+        Line(unpackColor(c.color), c.a, c.b);
+        break;
+      case ngDrawList::Kind::TEXT:
+        Text(unpackColor(c.color), c.a, c.b.x, ref.list->TextAt(c.extra));
+        break;
+    }
+  }
+  if (pushed) {
+    Pop();
+  }
+}
+
+void ngProcessBase::SetFixedTimestep(float step, int max_steps) {
+  fixed_step_ = step > 0.f ? step : 0.0;
+  max_steps_ = max(max_steps, 1);
+  accumulator_ = 0.0;
+}
+
+void ngProcessBase::SetLowLatencyMode(bool enable, int max_queued_frames) {
+#if !defined(__EMSCRIPTEN__)
+  low_latency_ = enable;
+  max_queued_frames_ = enable ? max_queued_frames : -1;
+  latency_pacer_.Reset();
+#endif
+}
+
+bool ngProcessBase::StartRecording(const char* path) {
+  auto recorder = std::make_unique<InputLogWriter>();
+  if (!recorder->Open(path)) {
+    return false;
+  }
+  input_recorder_ = std::move(recorder);
+  return true;
+}
+
+bool ngProcessBase::StartReplay(const char* path) {
+  auto replayer = std::make_unique<InputLogReader>();
+  if (!replayer->Open(path)) {
+    return false;
+  }
+  input_replayer_ = std::move(replayer);
+  replay_begin_ = SDL_GetPerformanceCounter();
+  replay_frames_ = 0;
+  return true;
+}
+
+void ngProcessBase::ExitLoop() { exit_ = true; }
+
+void ngProcessBase::Push(const mat3& mat) {
+  Push(ngAffine2D::FromMat3(mat));
+}
+
+void ngProcessBase::Push(const ngAffine2D& t) {
+  trans_stack_.push_back(trans_stack_.back() * t);
+}
+
+void ngProcessBase::Pop() { trans_stack_.pop_back(); }
+
+void ngProcessBase::Tick() {
+  NG_PROFILE_ZONE("ngProcess::Tick");
+  profiler_.BeginFrame();
+
+  // sleep instead of waiting for vsync in the last frame, so that input is
+  // sampled closer to the next vsync.
+  if (low_latency_) {
+    NG_PROFILE_ZONE("Sleep");
+    ScopedPhase phase(profiler_, ngFramePhase::SLEEP);
+    sleepPrecise(latency_pacer_.SleepTime());
+  }
+
+  // update tick counter
+  tick_counter_.Remember();
+
+  // process all event
+  size_t event_begin = input_events_.size();
+  {
+    NG_PROFILE_ZONE("ProcessEvents");
+    ScopedPhase phase(profiler_, ngFramePhase::EVENT);
+    ProcessEvents();
+  }
+
+  // input. prev_state_ is advanced by each update, so that a press is seen
+  // by the next update even if no update runs in this frame.
+  double dt = DeltaTime();
+  {
+    NG_PROFILE_ZONE("SampleInput");
+    ScopedPhase phase(profiler_, ngFramePhase::INPUT);
+    current_state_ = SampleInput();
+    if (input_replayer_ && !ReplayInput(event_begin, &dt)) {
+      return;
+    }
+    if (input_recorder_) {
+      input_recorder_->Write(dt, current_state_,
+                             input_events_.data() + event_begin,
+                             input_events_.size() - event_begin);
+    }
+    draw_cursor_ = current_state_.mouse_position;
+  }
+  if (trace_export_code_ >= 0 &&
+      IsJustPressed(ngKeyCode(trace_export_code_))) {
+    ExportTrace();
+  }
+
+  // initialize matrix
+  trans_stack_.clear();
+  trans_stack_.push_back(
+      ngAffine2D::TranslateScale(vec2(0.f), vec2(1.f) / window_size_));
+
+  glyph_cache_.NextFrame();
+  BeginFrame();
+
+  // update game. with pipelining, the worker updates until the end of the
+  // frame, while the list of the previous frame is drawn.
+  float alpha = 1.f;
+  if (pipelined_) {
+#if !defined(__EMSCRIPTEN__)
+    update_worker_.Start(
+        [this, dt] { worker_alpha_ = UpdateSteps(dt, &worker_steps_); });
+#endif
+    alpha = drawn_alpha_;
+  } else {
+    int steps;
+    ScopedPhase phase(profiler_, ngFramePhase::UPDATE);
+    alpha = UpdateSteps(dt, &steps);
+  }
+
+  {
+    NG_PROFILE_ZONE("Render");
+    ScopedPhase phase(profiler_, ngFramePhase::RENDER);
+    // late latch the cursor for drawing, but not over a replayed one.
+    if (low_latency_ && !input_replayer_) {
+      draw_cursor_ = SampleCursor();
+    }
+    if (render_callback_) {
+      render_callback_(*this, alpha);
+    }
+    if (show_stats_) {
+      DrawStatsOverlay();
+    }
+    Submit();
+  }
+
+  {
+    NG_PROFILE_ZONE("Present");
+    ScopedPhase phase(profiler_, ngFramePhase::SWAP);
+    Present();
+  }
+  if (pipelined_) {
+#if !defined(__EMSCRIPTEN__)
+    ScopedPhase phase(profiler_, ngFramePhase::UPDATE);
+    update_worker_.Wait();
+#endif
+    // a frame without updates recorded nothing, so keep drawing the last
+    // recorded list.
+    if (worker_steps_ > 0) {
+      record_index_ = 1 - record_index_;
+    }
+    drawn_alpha_ = worker_alpha_;
+  }
+  if (low_latency_) {
+    latency_pacer_.AddIdle(profiler_.PhaseTime(ngFramePhase::SLEEP) +
+                           profiler_.PhaseTime(ngFramePhase::SWAP));
   }
-  bool GetMouseButtonState(int num) const { return mouse_button[num]; }
-};
 
-InputState GetInput() {
-  InputState state;
+  profiler_.EndFrame(tick_counter_.FPS());
+}
 
-  // key
-  int num_keys;
-  const Uint8* key_state = SDL_GetKeyboardState(&num_keys);
-  state.key.assign(key_state, key_state + num_keys);
+// UpdateSteps runs updates for dt seconds, stores the number of them to
+// steps and returns alpha for the renderer.
+float ngProcessBase::UpdateSteps(double dt, int* steps) {
+  NG_PROFILE_ZONE("Update");
+  if (fixed_step_ <= 0.0) {
+    Update((float)dt);
+    *steps = 1;
+    return 1.f;
+  }
+  // drop time which can't be caught up within max_steps_, rather than
+  // falling further behind every frame.
+  accumulator_ = min(accumulator_ + dt, fixed_step_ * max_steps_);
+  *steps = 0;
+  while (accumulator_ >= fixed_step_) {
+    Update((float)fixed_step_);
+    accumulator_ -= fixed_step_;
+    (*steps)++;
+  }
+  return (float)(accumulator_ / fixed_step_);
+}
 
-  // mouse
-  int button =
-      SDL_GetMouseState(&state.mouse_position.x, &state.mouse_position.y);
-  const int kMouseButtonNum = 5 + 1;
-  state.mouse_button.resize(kMouseButtonNum);
-  for (int i = 0; i < kMouseButtonNum; i++) {
-    state.mouse_button[i] = button & SDL_BUTTON(i);
+void ngProcessBase::Update(float dt) {
+  updater_(*this, dt);
+  prev_state_ = current_state_;
+  for (const ngInputEvent& event : input_events_) {
+    press_count_[event.code] = 0;
+    release_count_[event.code] = 0;
   }
+  input_events_.clear();
+}
 
-  return state;
+// ReplayInput replaces input of this frame with the next frame of the log.
+// Events which happened in this frame from event_begin are discarded. It
+// returns false and exits the loop at the end of the log.
+bool ngProcessBase::ReplayInput(size_t event_begin, double* dt) {
+  for (size_t i = event_begin; i < input_events_.size(); i++) {
+    const ngInputEvent& event = input_events_[i];
+    (event.pressed ? press_count_ : release_count_)[event.code]--;
+  }
+  input_events_.resize(event_begin);
+
+  double sec = (SDL_GetPerformanceCounter() - replay_begin_) /
+               double(SDL_GetPerformanceFrequency());
+  profiler_.SetReplay(replay_frames_, float(sec));
+  if (!input_replayer_->Read(dt, &current_state_, &replay_events_)) {
+    input_replayer_.reset();
+    ExitLoop();
+    return false;
+  }
+  for (const ngInputEvent& event : replay_events_) {
+    PushInputEvent(event.code, event.pressed, event.time);
+  }
+  replay_frames_++;
+  return true;
 }
 
-}  // namespace
+void ngProcessBase::ExportTrace() {
+  if (!trace_path_.empty()) {
+    ngProfiler::ExportChromeTrace(trace_path_.c_str());
+  }
+}
 
-glm::mat3 ngMath::TRS(vec2 pos, float rad, vec2 s) {
-  return scale(rotate(translate(mat3(1.f), pos), rad), s);
+void ngProcessBase::DrawStatsOverlay() {
+  const ngFrameStats& stats = profiler_.Stats();
+  const float kSize = 16.f;
+  auto msec = [&](ngFramePhase phase) {
+    return fmt::format("{0:.2f}/{1:.2f}/{2:.2f}",
+                       stats.time[int(phase)] * 1000.f,
+                       stats.p95[int(phase)] * 1000.f,
+                       stats.p99[int(phase)] * 1000.f);
+  };
+  std::string lines[] = {
+      fmt::format("fps {0:.1f} frame {1} ms", stats.fps,
+                  msec(ngFramePhase::TOTAL)),
+      fmt::format("sleep {0} event {1} input {2}", msec(ngFramePhase::SLEEP),
+                  msec(ngFramePhase::EVENT), msec(ngFramePhase::INPUT)),
+      fmt::format("update {0}", msec(ngFramePhase::UPDATE)),
+      fmt::format("render {0} swap {1}", msec(ngFramePhase::RENDER),
+                  msec(ngFramePhase::SWAP)),
+      fmt::format("draw {0} buffer {1} texture {2}", stats.counters.draw_calls,
+                  stats.counters.buffer_uploads,
+                  stats.counters.texture_uploads),
+  };
+
+  // draw on top of the screen regardless of transform left by the game.
+  trans_stack_.resize(1);
+  vec2 pos(-window_size_.x, window_size_.y - kSize);
+  for (const std::string& line : lines) {
+    Text(kBlack, pos + vec2(1.f, -1.f), kSize, line.c_str());
+    Text(kWhite, pos, kSize, line.c_str());
+    pos.y -= kSize;
+  }
 }
 
-class ngProcessImpl : public ngProcess {
+// ngProcessImpl renders with OpenGL to a SDL window.
+class ngProcessImpl : public ngProcessBase {
  private:
   SDL_Window* window_;
   SDL_GLContext gl_context_;
   GLuint vao_id_;
   GLuint primitive_program_id_;
-  GLuint primitive_uniform_matrix_id_;
-  GLuint primitive_uniform_color_id_;
+  PrimitiveBatch primitive_batch_;
+
+  // shapes are drawn with primitive_batch_ if instancing is unavailable.
+  bool use_shape_batch_ = false;
+  GLuint shape_program_id_;
+  ShapeBatch shape_batch_;
+  std::vector<std::vector<vec2>> circle_lods_;
 
   GLuint textured_program_id_;
-  GLuint textured_uniform_matrix_id_;
   GLuint textured_uniform_texture_id_;
-  GLuint textured_uniform_color_id_;
-
-  vec2 window_size_;
-  std::vector<mat3> trans_stack_;
-  GLuint square_vertex_buffer_id_;
-  GLuint line_vertex_buffer_id_;
-  std::vector<vec2> circle_vertex_;
-  GLuint circle_vertex_buffer_id_;
-
-  GLuint text_vertex_buffer_id_;
-  GLuint text_uv_buffer_id_;
-  GLuint text_texture_id_;
-
-  InputState current_state_;
-  InputState prev_state_;
-  std::map<ngKeyCode, char> keyboard_mapping_;
-  std::map<ngKeyCode, uint8_t> mouse_button_mapping_;
-
-  FT_Library library_;
-  FT_Face face_;
-  FT_GlyphSlot slot_;
+  TextBatch text_batch_;
 
-  TickCounter tick_counter_;
-
-  ngUpdater updater_;
+  std::vector<GLuint> glyph_texture_ids_;
 
-  bool exit_;
+  // fences of frames presented but maybe not finished on GPU
+  std::deque<GLsync> frame_fences_;
 
  public:
   virtual ~ngProcessImpl();
   bool Init() override;
-  void Run(ngUpdater updater) override;
-  void ExitLoop() override;
-  void Push(const mat3& mat) override;
 
-  void Pop() override;
   void Clear(const ngColor& col) override {
+    NG_PROFILE_ZONE("ngProcess::Clear");
+    // everything queued so far would be overwritten.
+    primitive_batch_.Discard();
+    shape_batch_.Discard();
+    text_batch_.Discard();
     glClearColor(col.r / 255.f, col.g / 255.f, col.b / 255.f, col.a / 255.f);
     glClear(GL_COLOR_BUFFER_BIT);
   }
 
   void Rect(const ngColor& border, const ngColor& fill, const vec2& center,
             const vec2& size) override {
-    Push(ngMath::TRS(center, 0, size));
-
-    glUseProgram(primitive_program_id_);
-
-    // setup uniform
-    glUniformMatrix3fv(primitive_uniform_matrix_id_, 1, GL_FALSE,
-                       &trans_stack_.back()[0][0]);
-    vec4 col = color256To1_0(fill);
-    glUniform4fv(primitive_uniform_color_id_, 1, (GLfloat*)&col);
-
-    // setup vertex
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, square_vertex_buffer_id_);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-    glDrawArrays(GL_TRIANGLE_STRIP, 0, kSquareVertex.size());
+    NG_PROFILE_ZONE("ngProcess::Rect");
+    ngAffine2D m = trans_stack_.back().TranslateScaled(center, size);
+    AddShape(ShapeKind::RECT, m, color256ToU8(fill), color256ToU8(border));
+  }
 
-    glDisableVertexAttribArray(0);
-    Pop();
+  void Line(const ngColor& col, const vec2& pos1, const vec2& pos2) override {
+    NG_PROFILE_ZONE("ngProcess::Line");
+    const ngAffine2D& m = trans_stack_.back();
+    u8vec4 col_u8 = color256ToU8(col);
+    BeginPrimitive(GL_LINES);
+    primitive_batch_.Add(m.Apply(pos1), col_u8);
+    primitive_batch_.Add(m.Apply(pos2), col_u8);
   }
 
-  void Square(const ngColor& border, const ngColor& fill, const vec2& center,
-              const float size) override {
-    Rect(border, fill, center, {size, size});
+  void Circle(const ngColor& border, const ngColor& fill, const ngCoord& center,
+              const float& length) override {
+    NG_PROFILE_ZONE("ngProcess::Circle");
+    ngAffine2D m =
+        trans_stack_.back().TranslateScaled(center, {length, length});
+    AddShape(ShapeKind::CIRCLE, m, color256ToU8(fill), color256ToU8(border));
   }
 
-  void Line(const ngColor& col, const vec2& pos1, const vec2& pos2) override {
-    vec2 d = pos2 - pos1;
-    float a = atan2(d.y, d.x);
-    float l = length(d);
-    Push(ngMath::TRS(pos1, a, {l, l}));
-    glUseProgram(primitive_program_id_);
-
-    // setup uniform
-    glUniformMatrix3fv(primitive_uniform_matrix_id_, 1, GL_FALSE,
-                       &trans_stack_.back()[0][0]);
-    vec4 col1_0 = color256To1_0(col);
-    glUniform4fv(primitive_uniform_color_id_, 1, (GLfloat*)&col1_0);
-
-    // setup vertex
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, line_vertex_buffer_id_);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  bool SaveFrame(const char* path) override {
+    NG_PROFILE_ZONE("ngProcess::SaveFrame");
+    FlushBatches();
+    int w = (int)window_size_.x;
+    int h = (int)window_size_.y;
+    std::vector<uint32_t> pixels(w * h);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    // GL returns bottom row first
+    for (int y = 0; y < h / 2; y++) {
+      std::swap_ranges(&pixels[y * w], &pixels[y * w] + w,
+                       &pixels[(h - 1 - y) * w]);
+    }
+    return savePNG(path, &pixels[0], {w, h});
+  }
 
-    glDrawArrays(GL_LINE_STRIP, 0, kLineVertex.size());
+ protected:
+  void ProcessEvents() override {
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+      switch (event.type) {
+        case SDL_QUIT: {
+          exit_ = true;
+          break;
+        }
+        case SDL_WINDOWEVENT: {
+          if (event.window.event == SDL_WINDOWEVENT_CLOSE &&
+              event.window.windowID == SDL_GetWindowID(window_)) {
+            exit_ = true;
+          }
+          break;
+        }
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: {
+          // auto repeat is not a press
+          if (event.key.repeat) {
+            break;
+          }
+          bool pressed = event.type == SDL_KEYDOWN;
+          double time = event.key.timestamp / 1000.0;
+          action_table_.ForEachKeyAction(
+              event.key.keysym.scancode,
+              [&](ngKeyCode code) { PushInputEvent(code, pressed, time); });
+          break;
+        }
+        case SDL_MOUSEBUTTONDOWN:
+        case SDL_MOUSEBUTTONUP: {
+          bool pressed = event.type == SDL_MOUSEBUTTONDOWN;
+          double time = event.button.timestamp / 1000.0;
+          action_table_.ForEachMouseAction(
+              event.button.button,
+              [&](ngKeyCode code) { PushInputEvent(code, pressed, time); });
+          break;
+        }
+      }
+    }
+  }
 
-    glDisableVertexAttribArray(0);
-    Pop();
+  ivec2 SampleCursor() override {
+    ivec2 pos;
+    SDL_GetMouseState(&pos.x, &pos.y);
+    return pos;
   }
 
-  void Circle(const ngColor& border, const ngColor& fill, const ngCoord& center,
-              const float& length) override {
-    Push(ngMath::TRS(center, 0.f, {length, length}));
-    glUseProgram(primitive_program_id_);
+  InputState SampleInput() override {
+    InputState state;
+    int num_keys;
+    const Uint8* key_state = SDL_GetKeyboardState(&num_keys);
+    Uint32 mouse_buttons =
+        SDL_GetMouseState(&state.mouse_position.x, &state.mouse_position.y);
+    state.actions = action_table_.Sample(key_state, num_keys, mouse_buttons);
+    return state;
+  }
 
-    // setup uniform
-    glUniformMatrix3fv(primitive_uniform_matrix_id_, 1, GL_FALSE,
-                       &trans_stack_.back()[0][0]);
-    vec4 col1_0 = color256To1_0(fill);
-    glUniform4fv(primitive_uniform_color_id_, 1, (GLfloat*)&col1_0);
+  void BeginFrame() override {
+    glViewport(0, 0, window_size_.x, window_size_.y);
+  }
 
-    // setup vertex
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, circle_vertex_buffer_id_);
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+  void Submit() override {
+    // submit primitives and text remaining in the batches
+    FlushBatches();
+  }
 
-    glDrawArrays(GL_TRIANGLE_FAN, 0, circle_vertex_.size());
+  void Present() override {
+    SDL_GL_SwapWindow(window_);
+    ThrottleQueuedFrames();
+  }
 
-    glDisableVertexAttribArray(0);
-    Pop();
+  void DrawGlyph(const GlyphCache::Glyph& glyph, const vec2 (&quad)[4],
+                 const vec2& uv0, const vec2& uv1,
+                 const u8vec4& color) override {
+    BeginText(glyph.page);
+    text_batch_.AddQuad(quad, uv0, uv1, color);
   }
 
-  void Text(const ngColor& col, const ngCoord& pos, float length,
-            const char* str) override {
-    uint32_t codepoint;
-    uint32_t state = 0;
-    float x_advance = 0.f;
-    for (; *str; ++str) {
-      if (!utf8decode(&state, &codepoint, *str)) {
-        FT_Error err;
-        if (err = FT_Load_Glyph(face_, FT_Get_Char_Index(face_, codepoint),
-                                FT_LOAD_RENDER | FT_LOAD_COLOR),
-            err != 0) {
-          fprintf(stderr, "failed to FT_Load_Glyph\n");
-          return;
-        };
+ private:
+  // ThrottleQueuedFrames waits until at most max_queued_frames_ frames are
+  // queued on GPU.
+  void ThrottleQueuedFrames() {
+    if (max_queued_frames_ < 0) {
+      return;
+    }
+    NG_PROFILE_ZONE("ThrottleQueuedFrames");
+    if (max_queued_frames_ == 0) {
+      glFinish();
+      return;
+    }
+    frame_fences_.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    while ((int)frame_fences_.size() > max_queued_frames_) {
+      const GLuint64 kTimeout = 100 * 1000 * 1000;  // nanoseconds
+      glClientWaitSync(frame_fences_.front(), GL_SYNC_FLUSH_COMMANDS_BIT,
+                       kTimeout);
+      glDeleteSync(frame_fences_.front());
+      frame_fences_.pop_front();
+    }
+  }
 
-        std::vector<u8> pixels((64 + 4) * (64 + 4));
+  void AddShape(ShapeKind kind, const ngAffine2D& m, const u8vec4& fill,
+                const u8vec4& border) {
+    if (use_shape_batch_) {
+      BeginShape();
+      shape_batch_.Add(kind, m, fill, border);
+      return;
+    }
+    // without the shape shader, draw the fill over the border inset by the
+    // border width. edges are not anti-aliased.
+    vec2 half_px = shapeHalfPixels(m.x_axis, m.y_axis, window_size_);
+    vec2 inset = max(vec2(0.f), vec2(1.f) - kShapeBorderWidth / half_px);
+    if (kind == ShapeKind::CIRCLE) {
+      inset = vec2(min(inset.x, inset.y));
+    }
+    AddShapePrimitive(kind, m, half_px, border);
+    AddShapePrimitive(kind, m.TranslateScaled(vec2(0.f), inset),
+                      half_px * inset, fill);
+  }
 
-        const FT_GlyphSlot& glyph = face_->glyph;
-        const FT_Bitmap& bitmap = glyph->bitmap;
-        const FT_Glyph_Metrics& metrics = glyph->metrics;
+  void AddShapePrimitive(ShapeKind kind, const ngAffine2D& m,
+                         const vec2& half_px, const u8vec4& col) {
+    BeginPrimitive(GL_TRIANGLES);
+    if (kind == ShapeKind::RECT) {
+      vec2 v[4];
+      for (int i = 0; i < 4; i++) {
+        v[i] = m.Apply(kSquareVertex[i]);
+      }
+      // triangle strip (0, 1, 2, 3) as a triangle list
+      primitive_batch_.Add(v[0], col);
+      primitive_batch_.Add(v[1], col);
+      primitive_batch_.Add(v[2], col);
+      primitive_batch_.Add(v[2], col);
+      primitive_batch_.Add(v[1], col);
+      primitive_batch_.Add(v[3], col);
+      return;
+    }
 
-        for (int y = 0; y < bitmap.rows; y++) {
-          for (int x = 0; x < bitmap.width; x++) {
-            pixels[(bitmap.rows - 1 - y) * 64 + x] =
-                bitmap.buffer[y * bitmap.width + x];
-          }
-        }
+    // triangle fan as a triangle list
+    const std::vector<vec2>& fan = CircleFan(max(half_px.x, half_px.y));
+    vec2 c = m.Apply(fan[0]);
+    vec2 prev = m.Apply(fan[1]);
+    for (size_t i = 2; i < fan.size(); i++) {
+      vec2 next = m.Apply(fan[i]);
+      primitive_batch_.Add(c, col);
+      primitive_batch_.Add(prev, col);
+      primitive_batch_.Add(next, col);
+      prev = next;
+    }
+  }
 
-        glBindTexture(GL_TEXTURE_2D, text_texture_id_);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 64, 64, 0, GL_RED,
-                     GL_UNSIGNED_BYTE, &pixels[0]);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        // glGenerateMipmap(GL_TEXTURE_2D);
-
-        Push(ngMath::TRS(pos, 0.f, {length / 64, length / 64}));
-        glUseProgram(textured_program_id_);
-
-        // setup uniform
-        glUniformMatrix3fv(textured_uniform_matrix_id_, 1, GL_FALSE,
-                           &trans_stack_.back()[0][0]);
-        vec4 col1_0 = color256To1_0(col);
-        glUniform4fv(textured_uniform_color_id_, 1, (GLfloat*)&col1_0);
-        glUniform1i(textured_uniform_texture_id_, 0);
-
-        // setup vertex
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, text_vertex_buffer_id_);
-        vec2 origin = {metrics.horiBearingX + x_advance,
-                       -metrics.height + metrics.horiBearingY};
-        vec2 right = {metrics.width, 0};
-        vec2 up = {0, metrics.height};
-        float scale = 1.f / 64.f;
-        std::vector<vec2> text_vertex{
-            scale * origin,
-            scale * (origin + up),
-            scale * (origin + right),
-            scale * (origin + right + up),
-        };
-        glBufferData(GL_ARRAY_BUFFER,
-                     sizeof(text_vertex[0]) * text_vertex.size(),
-                     &text_vertex[0], GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, text_uv_buffer_id_);
-        float uv_w = bitmap.width / 64.f;
-        float uv_h = bitmap.rows / 64.f;
-
-        std::vector<vec2> uv_vertex{
-            {0, 0},
-            {0, uv_h},
-            {uv_w, 0},
-            {uv_w, uv_h},
-        };
-        glBufferData(GL_ARRAY_BUFFER, sizeof(uv_vertex[0]) * uv_vertex.size(),
-                     &uv_vertex[0], GL_DYNAMIC_DRAW);
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, text_vertex.size());
-
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-        Pop();
-        x_advance += metrics.horiAdvance;
+  // CircleFan returns a unit circle as a triangle fan whose segments are
+  // about 4 pixels long at radius_px. Fans are cached per power of two
+  // segments.
+  const std::vector<vec2>& CircleFan(float radius_px) {
+    const int kMinSegments = 8;
+    const int kMaxLOD = 5;
+    int lod = 0;
+    while (lod < kMaxLOD &&
+           (kMinSegments << lod) * 4.f < 2.f * pi<float>() * radius_px) {
+      lod++;
+    }
+    if ((int)circle_lods_.size() <= lod) {
+      circle_lods_.resize(lod + 1);
+    }
+    std::vector<vec2>& fan = circle_lods_[lod];
+    if (fan.empty()) {
+      int segments = kMinSegments << lod;
+      fan.push_back({0.f, 0.f});
+      for (int i = 0; i <= segments; i++) {
+        float rad = pi<float>() * 2.f * float(i) / float(segments);
+        fan.push_back({cos(rad), sin(rad)});
       }
     }
+    return fan;
   }
 
-  void MapKeyboard(char key, ngKeyCode code) override {
-    keyboard_mapping_.insert_or_assign(code, key);
+  // BeginPrimitive prepares to add primitives of mode, submitting pending
+  // shapes and text to keep the drawing order.
+  void BeginPrimitive(GLenum mode) {
+    shape_batch_.Flush();
+    FlushText();
+    primitive_batch_.Begin(mode);
   }
 
-  void MapMouseButton(uint8_t num, ngKeyCode code) override {
-    mouse_button_mapping_.insert_or_assign(code, num);
+  // BeginShape prepares to add shapes, submitting pending primitives and
+  // text.
+  void BeginShape() {
+    primitive_batch_.Flush();
+    FlushText();
   }
 
-  // void MapPadButton(uint8_t padIndex, uint8_t buttonIndex,
-  //                  ngKeyCode code) override {
-  //  throw std::logic_error("The method or operation is not implemented.");
-  //}
-
-  bool GetButtonState(const InputState& state, ngKeyCode code) {
-    bool button = false;
-    if (auto it = keyboard_mapping_.find(code); it != keyboard_mapping_.end()) {
-      button |= !!state.GetKeyState(SDL_KeyCode(it->second));
-    }
-    if (auto it = mouse_button_mapping_.find(code);
-        it != mouse_button_mapping_.end()) {
-      button |= !!state.GetMouseButtonState(it->second);
+  // BeginText prepares to add glyphs on the atlas page, submitting pending
+  // primitives, shapes and glyphs of another page.
+  void BeginText(int page) {
+    primitive_batch_.Flush();
+    shape_batch_.Flush();
+    if (text_batch_.Page() != page) {
+      FlushText();
+      text_batch_.SetPage(page);
     }
-    return button;
   }
 
-  bool IsHold(ngKeyCode code) override {
-    return GetButtonState(current_state_, code);
+  void FlushText() {
+    if (text_batch_.Empty()) {
+      return;
+    }
+    BindGlyphPage(text_batch_.Page());
+    text_batch_.Flush();
   }
 
-  bool IsJustPressed(ngKeyCode code) override {
-    return GetButtonState(current_state_, code) &&
-           !GetButtonState(prev_state_, code);
+  void FlushBatches() {
+    NG_PROFILE_ZONE("ngProcess::FlushBatches");
+    primitive_batch_.Flush();
+    shape_batch_.Flush();
+    FlushText();
   }
 
-  ngCoord CursorPos() override {
-    return ngCoord(current_state_.mouse_position);
-  }
+  // BindGlyphPage binds texture of the atlas page, uploading rows modified
+  // since last use.
+  void BindGlyphPage(int page) {
+    while ((int)glyph_texture_ids_.size() <= page) {
+      GLuint texture_id;
+      glGenTextures(1, &texture_id);
+      glBindTexture(GL_TEXTURE_2D, texture_id);
+      glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, GlyphCache::kPageSize,
+                   GlyphCache::kPageSize, 0, GL_RED, GL_UNSIGNED_BYTE,
+                   nullptr);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glyph_texture_ids_.push_back(texture_id);
+      profiler_.Counters().texture_uploads++;
+    }
 
-  void Tick();
+    glBindTexture(GL_TEXTURE_2D, glyph_texture_ids_[page]);
+    const GlyphCache::Page& p = glyph_cache_.GetPage(page);
+    if (p.IsDirty()) {
+      glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, 0, p.dirty_min_y,
+                      GlyphCache::kPageSize, p.dirty_max_y - p.dirty_min_y,
+                      GL_RED, GL_UNSIGNED_BYTE,
+                      &p.pixels[p.dirty_min_y * GlyphCache::kPageSize]);
+      glyph_cache_.MarkUploaded(page);
+      profiler_.Counters().texture_uploads++;
+    }
+  }
 };
 
 ngProcessImpl::~ngProcessImpl() {
+  for (GLsync fence : frame_fences_) {
+    glDeleteSync(fence);
+  }
+  primitive_batch_.Release();
+  if (use_shape_batch_) {
+    shape_batch_.Release();
+  }
+  text_batch_.Release();
+  if (!glyph_texture_ids_.empty()) {
+    glDeleteTextures(glyph_texture_ids_.size(), &glyph_texture_ids_[0]);
+  }
   glDeleteVertexArrays(1, &vao_id_);
   SDL_GL_DeleteContext(gl_context_);
   SDL_DestroyWindow(window_);
@@ -447,12 +3054,16 @@ ngProcessImpl::~ngProcessImpl() {
 }
 
 bool ngProcessImpl::Init() {
-  exit_ = false;
+  if (!InitCommon()) {
+    return false;
+  }
 
   if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS | SDL_INIT_AUDIO) != 0) {
     fprintf(stderr, "ERROR: %s\n", SDL_GetError());
     return false;
   }
+  // keys mapped before Init couldn't be resolved without the keyboard
+  action_table_.Resolve();
 
   int flags = IMG_INIT_JPG | IMG_INIT_PNG;
   if (!(IMG_Init(flags) & flags)) {
@@ -460,8 +3071,6 @@ bool ngProcessImpl::Init() {
     return false;
   }
 
-  window_size_ = vec2(320, 240);
-
 #if defined(__EMSCRIPTEN__)
 #define SHADER_HEADER "#version 300 es"
   NG_VERIFY(!SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, 0));
@@ -488,7 +3097,7 @@ bool ngProcessImpl::Init() {
   window_ =
       SDL_CreateWindow("ng", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
                        (int)window_size_.x, (int)window_size_.y, window_flags);
-  SDL_GLContext gl_context_ = SDL_GL_CreateContext(window_);
+  gl_context_ = SDL_GL_CreateContext(window_);
   NG_VERIFY(!SDL_GL_MakeCurrent(window_, gl_context_));
   NG_VERIFY(!SDL_GL_SetSwapInterval(1));  // Enable vsync
 
@@ -504,18 +3113,19 @@ bool ngProcessImpl::Init() {
   const char* PRIMITIVE_VERTEX_SHADER_CODE = SHADER_HEADER R"(
 precision mediump float;
 layout(location = 0) in vec2 in_position;
-uniform mat3 u_matrix;
+layout(location = 1) in vec4 in_color;
+out vec4 color;
 void main(){
-  vec3 pos = u_matrix * vec3(in_position, 1);
-	gl_Position =  vec4(pos, 1);
+	gl_Position = vec4(in_position, 0, 1);
+  color = in_color;
 }
 )";
   const char* PRIMITIVE_FRAGMENT_SHADER_CODE = SHADER_HEADER R"(
 precision mediump float;
-uniform vec4 u_color;
+in vec4 color;
 out vec4 out_color;
 void main(){
-    out_color = u_color;
+    out_color = color;
 }
 )";
 
@@ -524,33 +3134,98 @@ void main(){
                             &primitive_program_id_)) {
     return false;
   }
-  primitive_uniform_matrix_id_ =
-      glGetUniformLocation(primitive_program_id_, "u_matrix");
-  primitive_uniform_color_id_ =
-      glGetUniformLocation(primitive_program_id_, "u_color");
+  primitive_batch_.Init(primitive_program_id_, &profiler_.Counters());
+
+  // create shape shader, which draws rects and circles as instances of a
+  // unit quad. fill, border and anti-aliased edge are computed from distance
+  // to the edge in pixels.
+  const char* SHAPE_VERTEX_SHADER_CODE = SHADER_HEADER R"(
+precision mediump float;
+layout(location = 0) in vec2 in_position;
+layout(location = 1) in vec2 in_axis_x;
+layout(location = 2) in vec2 in_axis_y;
+layout(location = 3) in vec2 in_origin;
+layout(location = 4) in vec4 in_fill;
+layout(location = 5) in vec4 in_border;
+layout(location = 6) in float in_kind;
+uniform vec2 u_viewport_half;
+out vec2 local;
+out vec2 half_px;
+out vec4 fill;
+out vec4 border;
+flat out float kind;
+void main(){
+  half_px = vec2(length(in_axis_x * u_viewport_half),
+                 length(in_axis_y * u_viewport_half));
+  // grow the mesh by a pixel to leave room for anti-aliasing
+  local = in_position * (1.0 + 1.0 / max(half_px, vec2(0.001)));
+  vec2 p = in_axis_x * local.x + in_axis_y * local.y + in_origin;
+  gl_Position = vec4(p, 0, 1);
+  fill = in_fill;
+  border = in_border;
+  kind = in_kind;
+}
+)";
+  const char* SHAPE_FRAGMENT_SHADER_CODE = SHADER_HEADER R"(
+precision mediump float;
+const float kBorderWidth = 1.0;
+in vec2 local;
+in vec2 half_px;
+in vec4 fill;
+in vec4 border;
+flat in float kind;
+out vec4 out_color;
+void main(){
+  // distance from the edge in pixels, positive inside
+  float d;
+  if (kind > 0.5) {
+    d = (1.0 - length(local)) * min(half_px.x, half_px.y);
+  } else {
+    vec2 e = (1.0 - abs(local)) * half_px;
+    d = min(e.x, e.y);
+  }
+  float coverage = clamp(d + 0.5, 0.0, 1.0);
+  vec4 c = mix(border, fill, clamp(d - kBorderWidth + 0.5, 0.0, 1.0));
+  out_color = vec4(c.rgb, c.a * coverage);
+}
+)";
+
+  // fall back to transforming shapes on CPU if the context can't instance
+  // or the shape shader doesn't compile.
+  if (!supportsInstancing()) {
+    fprintf(stderr, "instanced shapes are disabled: no instancing\n");
+  } else if (!CompileShaderProgram(SHAPE_VERTEX_SHADER_CODE,
+                                   SHAPE_FRAGMENT_SHADER_CODE,
+                                   &shape_program_id_)) {
+    fprintf(stderr, "instanced shapes are disabled: shader error\n");
+  } else {
+    use_shape_batch_ = true;
+    shape_batch_.Init(shape_program_id_, window_size_, &profiler_.Counters());
+  }
 
   // create textured shader
   const char* TEXTURED_VERTEX_SHADER_CODE = SHADER_HEADER R"(
 precision mediump float;
 layout(location = 0) in vec2 in_position;
 layout(location = 1) in vec2 in_uv;
+layout(location = 2) in vec4 in_color;
 out vec2 uv;
-uniform mat3 u_matrix;
+out vec4 color;
 void main(){
-  vec3 pos = u_matrix * vec3(in_position, 1);
-	gl_Position = vec4(pos, 1);
+	gl_Position = vec4(in_position, 0, 1);
   uv = in_uv;
+  color = in_color;
 }
 )";
   const char* TEXTURED_FRAGMENT_SHADER_CODE = SHADER_HEADER R"(
 precision mediump float;
 in vec2 uv;
+in vec4 color;
 out vec4 out_color;
-uniform vec4 u_color;
 uniform sampler2D u_texture;
 void main(){
   float a = texture(u_texture, uv).r;
-  out_color = vec4(u_color.rgb, u_color.a * a);
+  out_color = vec4(color.rgb, color.a * a);
 }
 )";
 #undef SHADER_HEADER
@@ -560,38 +3235,11 @@ void main(){
                             &textured_program_id_)) {
     return false;
   }
-  textured_uniform_matrix_id_ =
-      glGetUniformLocation(textured_program_id_, "u_matrix");
   textured_uniform_texture_id_ =
       glGetUniformLocation(textured_program_id_, "u_texture");
-  textured_uniform_color_id_ =
-      glGetUniformLocation(textured_program_id_, "u_color");
-
-  // create vertex buffer
-  glGenBuffers(1, &square_vertex_buffer_id_);
-  glBindBuffer(GL_ARRAY_BUFFER, square_vertex_buffer_id_);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(kSquareVertex[0]) * kSquareVertex.size(),
-               &kSquareVertex[0], GL_STATIC_DRAW);
-  glGenBuffers(1, &line_vertex_buffer_id_);
-  glBindBuffer(GL_ARRAY_BUFFER, line_vertex_buffer_id_);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(kLineVertex[0]) * kLineVertex.size(),
-               &kLineVertex[0], GL_STATIC_DRAW);
-
-  circle_vertex_.clear();
-  circle_vertex_.push_back({0.f, 0.f});
-  for (int i = 0; i <= 32; i++) {
-    float rad = pi<float>() * 2.f * float(i) / 32.f;
-    circle_vertex_.push_back({cos(rad), sin(rad)});
-  }
-  glGenBuffers(1, &circle_vertex_buffer_id_);
-  glBindBuffer(GL_ARRAY_BUFFER, circle_vertex_buffer_id_);
-  glBufferData(GL_ARRAY_BUFFER,
-               sizeof(circle_vertex_[0]) * circle_vertex_.size(),
-               &circle_vertex_[0], GL_STATIC_DRAW);
-
-  glGenBuffers(1, &text_vertex_buffer_id_);
-  glGenBuffers(1, &text_uv_buffer_id_);
-  glGenTextures(1, &text_texture_id_);
+  text_batch_.Init(textured_program_id_, textured_uniform_texture_id_,
+                   &profiler_.Counters());
+  glyph_cache_.SetBeforeEvict([this]() { FlushText(); });
 
   // glEnable(GL_DEPTH_TEST);
   // glDepthFunc(GL_LESS);
@@ -601,97 +3249,102 @@ void main(){
   glEnable(GL_BLEND);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  if (FT_Init_FreeType(&library_) != 0) {
-    fprintf(stderr, "failed to FT_Init_FreeType\n");
-    return false;
-  }
-
-  const char* kFontFilePath = "asset/font/NotoSansJP-Regular.otf";
-  if (FT_New_Face(library_, kFontFilePath, 0, &face_) != 0) {
-    fprintf(stderr, "failed to FT_New_Face\n");
-    return false;
-  }
-
-  if (FT_Set_Pixel_Sizes(face_, 0, 64) != 0) {
-    fprintf(stderr, "failed to FT_Set_Pixel_Sizes\n");
-    return false;
-  }
-
-  tick_counter_.Reset();
-
   return true;
 }
 
-#if defined(__EMSCRIPTEN__)
-void esMainLoop(void* arg) {
-  auto* proc = reinterpret_cast<ngProcessImpl*>(arg);
-  proc->Tick();
-}
+// ngSoftwareProcessImpl renders into a frame buffer on CPU without window,
+// so that it runs on machines without GPU. There is no input, and frames
+// run as fast as possible with a fixed delta time.
+class ngSoftwareProcessImpl : public ngProcessBase {
+ private:
+  static constexpr double kFrameTime = 1.0 / 60.0;
 
-#endif
+  SoftwareRenderer renderer_;
 
-void ngProcessImpl::Run(ngUpdater updater) {
-  updater_ = updater;
-#if defined(__EMSCRIPTEN__)
-  emscripten_set_main_loop_arg(esMainLoop, this, 0, true);
-#else
-  while (!exit_) {
-    Tick();
+ public:
+  bool Init() override {
+    if (!InitCommon()) {
+      return false;
+    }
+    if (!(IMG_Init(IMG_INIT_PNG) & IMG_INIT_PNG)) {
+      fprintf(stderr, "Error: %s\n", IMG_GetError());
+      return false;
+    }
+    renderer_.Init(ivec2(window_size_));
+    return true;
   }
-#endif
-}
 
-void ngProcessImpl::ExitLoop() { exit_ = true; }
+  void Clear(const ngColor& col) override {
+    NG_PROFILE_ZONE("ngProcess::Clear");
+    renderer_.Clear(color256ToU8(col));
+  }
 
-void ngProcessImpl::Push(const mat3& mat) {
-  trans_stack_.push_back(trans_stack_.back() * mat);
-}
+  void Rect(const ngColor& border, const ngColor& fill, const vec2& center,
+            const vec2& size) override {
+    NG_PROFILE_ZONE("ngProcess::Rect");
+    ngAffine2D m = trans_stack_.back().TranslateScaled(center, size);
+    renderer_.FillShape({m.x_axis, m.y_axis, m.origin,
+                         color256ToU8(fill), color256ToU8(border),
+                         float(ShapeKind::RECT)});
+  }
 
-void ngProcessImpl::Pop() { trans_stack_.pop_back(); }
+  void Line(const ngColor& col, const vec2& pos1, const vec2& pos2) override {
+    NG_PROFILE_ZONE("ngProcess::Line");
+    const ngAffine2D& m = trans_stack_.back();
+    renderer_.DrawLine(m.Apply(pos1), m.Apply(pos2),
+                       color256ToU8(col));
+  }
 
-void ngProcessImpl::Tick() {
-  // update tick counter
-  tick_counter_.Remember();
-  if (tick_counter_.IsLogEnough()) {
-    // std::string title = fmt::format("ng fps:{0}", tick_counter_.FPS());
-    // SDL_SetWindowTitle(window_, title.c_str());
+  void Circle(const ngColor& border, const ngColor& fill, const ngCoord& center,
+              const float& length) override {
+    NG_PROFILE_ZONE("ngProcess::Circle");
+    ngAffine2D m =
+        trans_stack_.back().TranslateScaled(center, {length, length});
+    renderer_.FillShape({m.x_axis, m.y_axis, m.origin,
+                         color256ToU8(fill), color256ToU8(border),
+                         float(ShapeKind::CIRCLE)});
   }
 
-  // process all event
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT: {
-        exit_ = true;
-        break;
-      }
-      case SDL_WINDOWEVENT: {
-        if (event.window.event == SDL_WINDOWEVENT_CLOSE &&
-            event.window.windowID == SDL_GetWindowID(window_)) {
-          exit_ = true;
-        }
-        break;
-      }
-    }
+  bool SaveFrame(const char* path) override {
+    NG_PROFILE_ZONE("ngProcess::SaveFrame");
+    return savePNG(path, renderer_.Pixels(), renderer_.Size());
   }
 
-  // input
-  prev_state_ = current_state_;
-  current_state_ = GetInput();
+ protected:
+  void ProcessEvents() override {}
 
-  // initialize matrix
-  trans_stack_.clear();
-  trans_stack_.push_back(
-      scale(mat3(1.f), vec2(1.f / window_size_.x, 1.f / window_size_.y)));
-  glViewport(0, 0, window_size_.x, window_size_.y);
+  InputState SampleInput() override { return InputState(); }
 
-  // update game
-  updater_(*this, (float)(tick_counter_.ElapsedTickMsec()) * 0.001f);
-  SDL_GL_SwapWindow(window_);
-}
+  double DeltaTime() override { return kFrameTime; }
+
+  void BeginFrame() override {}
+
+  void Submit() override {}
+
+  void Present() override {}
 
-std::unique_ptr<ngProcess> ngProcess::NewProcess() {
-  return std::make_unique<ngProcessImpl>();
+  void DrawGlyph(const GlyphCache::Glyph& glyph, const vec2 (&quad)[4],
+                 const vec2& uv0, const vec2& uv1,
+                 const u8vec4& color) override {
+    const uint8_t* texture = &glyph_cache_.GetPage(glyph.page).pixels[0];
+    const int size = GlyphCache::kPageSize;
+    renderer_.FillTexturedTriangle({quad[0], quad[1], quad[2]},
+                                   {uv0, {uv0.x, uv1.y}, {uv1.x, uv0.y}},
+                                   texture, size, color);
+    renderer_.FillTexturedTriangle({quad[2], quad[1], quad[3]},
+                                   {{uv1.x, uv0.y}, {uv0.x, uv1.y}, uv1},
+                                   texture, size, color);
+  }
+};
+
+std::unique_ptr<ngProcess> ngProcess::NewProcess(ngBackend backend) {
+  switch (backend) {
+    case ngBackend::SOFTWARE:
+      return std::make_unique<ngSoftwareProcessImpl>();
+    case ngBackend::OPENGL:
+    default:
+      return std::make_unique<ngProcessImpl>();
+  }
 }
 
 ngRand::ngRand() { Seed(0xdeadbeef); }
@@ -702,15 +3355,70 @@ void ngRand::Seed(uint64_t seed) {
   xo_.s[1] = smix64_.next();
   xo_.s[2] = smix64_.next();
   xo_.s[3] = smix64_.next();
+  lane_origin_ = xo_;
+  lanes_seeded_ = false;
+}
+
+void ngRand::SeedLanes() {
+  // lanes start 2^128 apart from each other and from the single stream.
+  xoshiro256plusplus lane = lane_origin_;
+  for (int l = 0; l < kLaneNum; l++) {
+    lane.jump();
+    for (int i = 0; i < 4; i++) {
+      lanes_[i][l] = lane.s[i];
+    }
+  }
+  lanes_seeded_ = true;
+}
+
+std::vector<ngRand> ngRand::Split(int n) {
+  // a generator and its lanes use less than 2^192 of the period, so
+  // children start 2^192 apart, and 2^64 of them fit in it.
+  std::vector<ngRand> children(max(n, 0), *this);
+  xoshiro256plusplus x = xo_;
+  for (ngRand& child : children) {
+    x.long_jump();
+    child.xo_ = x;
+    child.lane_origin_ = x;
+    child.lanes_seeded_ = false;
+  }
+  x.long_jump();
+  xo_ = x;
+  lane_origin_ = x;
+  lanes_seeded_ = false;
+  return children;
 }
 
 uint64_t ngRand::UInt64() { return xo_.next(); }
 
 int ngRand::Int() { return static_cast<int>(UInt64()); }
 
+namespace {
+
+// boundedInt maps 32 random bits x to [0..n) by multiply and shift
+// (Lemire, "Fast Random Integer Generation in an Interval"). It returns
+// false if x has to be rejected to avoid bias, which is rare and the only
+// case that needs a division.
+inline bool boundedInt(uint32_t x, uint32_t n, uint32_t* out) {
+  uint64_t m = uint64_t(x) * n;
+  uint32_t l = uint32_t(m);
+  if (l < n && l < (0u - n) % n) {
+    return false;
+  }
+  *out = uint32_t(m >> 32);
+  return true;
+}
+
+}  // namespace
+
 int ngRand::IntN(int n) {
-  uint64_t v = UInt64();
-  return v % n;
+  if (legacy_int_n_) {
+    return UInt64() % n;
+  }
+  uint32_t v;
+  while (!boundedInt(uint32_t(UInt64() >> 32), n, &v)) {
+  }
+  return v;
 }
 
 int ngRand::Int1D(ivec2 minmax) {
@@ -747,3 +3455,152 @@ vec2 ngRand::Float2D(vec2 min, vec2 max) {
   float v2 = Float1D({min.y, max.y});
   return {v1, v2};
 }
+
+static_assert(ngRand::kLaneNum == 4, "lanes are vectorized as 4 x 64 bit");
+
+void ngRand::FillUInt64(uint64_t* out, size_t n) {
+  if (!lanes_seeded_) {
+    SeedLanes();
+  }
+#if defined(NG_USE_AVX2)
+  auto rotl = [](__m256i x, int k) {
+    return _mm256_or_si256(_mm256_slli_epi64(x, k),
+                           _mm256_srli_epi64(x, 64 - k));
+  };
+  __m256i s0 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(lanes_[0]));
+  __m256i s1 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(lanes_[1]));
+  __m256i s2 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(lanes_[2]));
+  __m256i s3 = _mm256_loadu_si256(reinterpret_cast<__m256i*>(lanes_[3]));
+  uint64_t tail[kLaneNum];
+  for (size_t i = 0; i < n; i += kLaneNum) {
+    __m256i result = _mm256_add_epi64(rotl(_mm256_add_epi64(s0, s3), 23), s0);
+    __m256i t = _mm256_slli_epi64(s1, 17);
+    s2 = _mm256_xor_si256(s2, s0);
+    s3 = _mm256_xor_si256(s3, s1);
+    s1 = _mm256_xor_si256(s1, s2);
+    s0 = _mm256_xor_si256(s0, s3);
+    s2 = _mm256_xor_si256(s2, t);
+    s3 = rotl(s3, 45);
+    uint64_t* dst = i + kLaneNum <= n ? out + i : tail;
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), result);
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes_[0]), s0);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes_[1]), s1);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes_[2]), s2);
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes_[3]), s3);
+#elif defined(NG_USE_SSE2)
+  // lanes 0-1 in a and lanes 2-3 in b
+  auto rotl = [](__m128i x, int k) {
+    return _mm_or_si128(_mm_slli_epi64(x, k), _mm_srli_epi64(x, 64 - k));
+  };
+  auto load = [](const uint64_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  };
+  auto store = [](uint64_t* p, __m128i v) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+  };
+  __m128i a0 = load(lanes_[0]), b0 = load(lanes_[0] + 2);
+  __m128i a1 = load(lanes_[1]), b1 = load(lanes_[1] + 2);
+  __m128i a2 = load(lanes_[2]), b2 = load(lanes_[2] + 2);
+  __m128i a3 = load(lanes_[3]), b3 = load(lanes_[3] + 2);
+  uint64_t tail[kLaneNum];
+  for (size_t i = 0; i < n; i += kLaneNum) {
+    __m128i ra = _mm_add_epi64(rotl(_mm_add_epi64(a0, a3), 23), a0);
+    __m128i rb = _mm_add_epi64(rotl(_mm_add_epi64(b0, b3), 23), b0);
+    __m128i ta = _mm_slli_epi64(a1, 17);
+    __m128i tb = _mm_slli_epi64(b1, 17);
+    a2 = _mm_xor_si128(a2, a0);
+    b2 = _mm_xor_si128(b2, b0);
+    a3 = _mm_xor_si128(a3, a1);
+    b3 = _mm_xor_si128(b3, b1);
+    a1 = _mm_xor_si128(a1, a2);
+    b1 = _mm_xor_si128(b1, b2);
+    a0 = _mm_xor_si128(a0, a3);
+    b0 = _mm_xor_si128(b0, b3);
+    a2 = _mm_xor_si128(a2, ta);
+    b2 = _mm_xor_si128(b2, tb);
+    a3 = rotl(a3, 45);
+    b3 = rotl(b3, 45);
+    uint64_t* dst = i + kLaneNum <= n ? out + i : tail;
+    store(dst, ra);
+    store(dst + 2, rb);
+  }
+  store(lanes_[0], a0);
+  store(lanes_[0] + 2, b0);
+  store(lanes_[1], a1);
+  store(lanes_[1] + 2, b1);
+  store(lanes_[2], a2);
+  store(lanes_[2] + 2, b2);
+  store(lanes_[3], a3);
+  store(lanes_[3] + 2, b3);
+#else
+  // run each lane through all rounds keeping its state in registers
+  uint64_t tail[kLaneNum];
+  size_t rounds = (n + kLaneNum - 1) / kLaneNum;
+  for (int l = 0; l < kLaneNum; l++) {
+    xoshiro256plusplus lane = {
+        {lanes_[0][l], lanes_[1][l], lanes_[2][l], lanes_[3][l]}};
+    for (size_t r = 0; r < rounds; r++) {
+      size_t j = r * kLaneNum;
+      (j + kLaneNum <= n ? out + j : tail)[l] = lane.next();
+    }
+    for (int k = 0; k < 4; k++) {
+      lanes_[k][l] = lane.s[k];
+    }
+  }
+#endif
+  // the last round was written to tail if n is not multiple of lanes
+  size_t rest = n % kLaneNum;
+  if (rest > 0) {
+    std::copy(tail, tail + rest, out + n - rest);
+  }
+}
+
+void ngRand::FillFloat(float* out, size_t n) {
+  // two floats from 24 bits of each half of a 64 bit value
+  const size_t kChunk = 256;
+  uint64_t bits[kChunk];
+  while (n > 0) {
+    size_t count = min(n, kChunk * 2);
+    size_t words = (count + 1) / 2;
+    FillUInt64(bits, words);
+    for (size_t i = 0; i < count / 2; i++) {
+      out[i * 2] = float(uint32_t(bits[i]) >> 8) * 0x1.0p-24f;
+      out[i * 2 + 1] = float(uint32_t(bits[i] >> 40)) * 0x1.0p-24f;
+    }
+    if (count % 2) {
+      out[count - 1] = float(uint32_t(bits[words - 1]) >> 8) * 0x1.0p-24f;
+    }
+    out += count;
+    n -= count;
+  }
+}
+
+void ngRand::FillIntN(int* out, size_t n, int bound) {
+  // two candidates from each 64 bit value, low half first
+  const size_t kChunk = 256;
+  uint64_t bits[kChunk];
+  size_t i = 0;
+  while (i < n) {
+    size_t words = min((n - i + 1) / 2, kChunk);
+    FillUInt64(bits, words);
+    for (size_t j = 0; j < words * 2 && i < n; j++) {
+      uint32_t x = uint32_t(bits[j / 2] >> (32 * (j & 1)));
+      uint32_t v;
+      if (boundedInt(x, bound, &v)) {
+        out[i++] = v;
+      }
+    }
+  }
+}
+
+void ngRand::FillFloat2D(vec2* out, size_t n, vec2 min, vec2 max) {
+  static_assert(sizeof(vec2) == sizeof(float) * 2, "vec2 must be packed");
+  float* p = reinterpret_cast<float*>(out);
+  FillFloat(p, n * 2);
+  vec2 range = max - min;
+  for (size_t i = 0; i < n; i++) {
+    p[i * 2] = min.x + p[i * 2] * range.x;
+    p[i * 2 + 1] = min.y + p[i * 2 + 1] * range.y;
+  }
+}
@@ -9,8 +9,11 @@ using namespace glm;
 
 #include <fmt/format.h>
 
+#include <algorithm>
+#include <array>
 #include <functional>
 #include <memory>
+#include <vector>
 
 #include "splitmix64.h"
 #include "xoshiro256plusplus.h"
@@ -62,13 +65,21 @@ enum class ngAlignY {
   BOTTOM,
 };
 
+enum class ngBackend {
+  // OPENGL renders to a window with OpenGL 3.3 or OpenGL ES 3.0.
+  OPENGL,
+  // SOFTWARE renders to a frame buffer on CPU without window and input.
+  // Frames run as fast as possible with a fixed delta time of 1/60 seconds.
+  SOFTWARE,
+};
+
 struct ngRand {
  public:
   ngRand();
   void Seed(uint64_t seed);
   uint64_t UInt64();
   int Int();
-  // [0..n)
+  // [0..n) without bias.
   int IntN(int n);
   // [min..max)
   int Int1D(ivec2 minmax);
@@ -83,9 +94,42 @@ struct ngRand {
   // [min..max)
   vec2 Float2D(vec2 min, vec2 max);
 
+  // Bulk generation uses kLaneNum generators interleaved, which are
+  // separate from the stream of the methods above. Each call advances all
+  // lanes by whole rounds, so the result depends only on the seed and the
+  // sequence of calls.
+  static const int kLaneNum = 4;
+  void FillUInt64(uint64_t* out, size_t n);
+  // [0..1)
+  void FillFloat(float* out, size_t n);
+  // [min..max)
+  void FillFloat2D(vec2* out, size_t n, vec2 min, vec2 max);
+  // [0..bound) without bias.
+  void FillIntN(int* out, size_t n, int bound);
+
+  // SetLegacyIntN makes IntN return UInt64() % n as older versions did, to
+  // reproduce sequences of existing seeds. It is slightly biased.
+  void SetLegacyIntN(bool legacy) { legacy_int_n_ = legacy; }
+
+  // Split returns n generators whose streams do not overlap with each other
+  // or with this one, e.g. one per worker thread. The i-th child depends
+  // only on the current state, and this generator moves past all of them so
+  // that a later Split gives new streams. ngRand itself is not thread safe.
+  std::vector<ngRand> Split(int n);
+
  private:
+  // SeedLanes derives lanes_ from lane_origin_ on the first bulk call, so
+  // seeding stays cheap for generators which never use them.
+  void SeedLanes();
+
   splitmix64 smix64_;
   xoshiro256plusplus xo_;
+  // state of xo_ when seeded or split
+  xoshiro256plusplus lane_origin_;
+  bool lanes_seeded_ = false;
+  // lanes_[i][lane] is s[i] of xoshiro256++ state of the lane.
+  uint64_t lanes_[4][kLaneNum];
+  bool legacy_int_n_ = false;
 };
 
 template <typename T>
@@ -97,11 +141,8 @@ struct ngShuffledBuffer {
   virtual void Fill() = 0;
   void Shuffle(ngRand& rng) {
     for (int i = buffer_.size() - 1; i > 0; i--) {
-      int n = rng.IntN(i);
-      // swap buffer_[i] and buffer_[n]
-      T tmp = buffer_[i];
-      buffer_[i] = buffer_[n];
-      buffer_[n] = tmp;
+      int n = rng.IntN(i + 1);
+      std::swap(buffer_[i], buffer_[n]);
     }
   }
   bool Empty() const { return buffer_.empty(); }
@@ -112,11 +153,66 @@ struct ngShuffledBuffer {
       Shuffle(rng);
     }
     T v = buffer_.back();
-    buffer_.resize(buffer_.size() - 1);
+    buffer_.pop_back();
     return v;
   }
 };
 
+// ngBag hands out a fixed set of N items in random order, refilling and
+// reshuffling when empty, e.g. a 7-bag of tetriminos or a loot table with
+// repeated entries. The storage is fixed, so a refill is a copy.
+//
+//   constexpr std::array<int, 7> kMinos = {1, 2, 3, 4, 5, 6, 7};
+//   ngBag<int, 7> bag(kMinos);
+template <typename T, size_t N>
+struct ngBag {
+ public:
+  constexpr explicit ngBag(const std::array<T, N>& items)
+      : items_(items), bag_(items), count_(0) {}
+
+  // Remaining returns the number of items until the next refill.
+  size_t Remaining() const { return count_; }
+  // Reset drops the remaining items, so the next Pop refills.
+  void Reset() { count_ = 0; }
+
+  T Pop(ngRand& rng) {
+    if (count_ == 0) {
+      Refill(rng);
+    }
+    return bag_[--count_];
+  }
+  // PopN stores n items to out in the same order as n calls of Pop.
+  void PopN(ngRand& rng, T* out, size_t n) {
+    while (n > 0) {
+      if (count_ == 0) {
+        Refill(rng);
+      }
+      size_t m = n < count_ ? n : count_;
+      for (size_t i = 0; i < m; i++) {
+        out[i] = bag_[count_ - 1 - i];
+      }
+      count_ -= m;
+      out += m;
+      n -= m;
+    }
+  }
+
+ private:
+  void Refill(ngRand& rng) {
+    static_assert(N > 0, "ngBag needs at least one item");
+    bag_ = items_;
+    // Fisher-Yates
+    for (size_t i = N - 1; i > 0; i--) {
+      std::swap(bag_[i], bag_[rng.IntN(int(i + 1))]);
+    }
+    count_ = N;
+  }
+
+  std::array<T, N> items_;
+  std::array<T, N> bag_;
+  size_t count_;
+};
+
 struct ngRect {
   vec2 pos;
   vec2 size;
@@ -181,6 +277,412 @@ struct ngBoard {
   }
 };  // struct ngBoard<Cell>
 
+// ngZobristKey returns a fixed pseudo random key for index, so board hashes
+// are the same across runs.
+inline uint64_t ngZobristKey(uint64_t index) {
+  splitmix64 s{index};
+  return s.next();
+}
+
+// ngBoardWalls blocks every cell outside a board.
+struct ngBoardWalls {
+  static bool Blocked(ivec2, ivec2) { return true; }
+};
+
+// ngBoardOpenTop blocks the sides and the bottom but not above the top,
+// where falling pieces spawn.
+struct ngBoardOpenTop {
+  static bool Blocked(ivec2 pos, ivec2 size) { return pos.y < size.y; }
+};
+
+// ngBitBoard is a non-virtual W x H board of occupied cells, one bit per
+// cell. Rows are stored bottom to top and bit x of a row is the cell at x,
+// so row tests and shape collisions are a few mask operations. Outside
+// decides which cells outside the board are occupied.
+//
+// For search, Snapshot/Restore undo changes through a journal of old rows
+// instead of copying the board, and Hash is a Zobrist hash of the occupied
+// cells kept up to date on each change unless Hashed is false.
+template <int W, int H, typename Outside = ngBoardWalls, bool Hashed = true>
+struct ngBitBoard {
+  static_assert(0 < W && W <= 64, "ngBitBoard rows are 64 bit masks");
+  static_assert(0 < H, "ngBitBoard needs at least one row");
+  typedef uint64_t Row;
+  static constexpr Row kFullRow = W == 64 ? ~Row(0) : (Row(1) << W) - 1;
+
+  constexpr ivec2 Size() const { return ivec2(W, H); }
+  static bool IsInside(ivec2 pos) {
+    return uint32_t(pos.x) < uint32_t(W) && uint32_t(pos.y) < uint32_t(H);
+  }
+
+  bool GetAt(ivec2 pos) const {
+    if (!IsInside(pos)) {
+      return Outside::Blocked(pos, Size());
+    }
+    return (rows_[pos.y] >> pos.x) & 1;
+  }
+  void SetAt(ivec2 pos, bool occupied) {
+    NG_ASSERT(IsInside(pos));
+    Row bit = Row(1) << pos.x;
+    WriteRow(pos.y, occupied ? rows_[pos.y] | bit : rows_[pos.y] & ~bit);
+  }
+
+  Row GetRow(int y) const { return rows_[y]; }
+  void SetRow(int y, Row mask) { WriteRow(y, mask & kFullRow); }
+  bool IsRowFull(int y) const { return rows_[y] == kFullRow; }
+  bool IsRowEmpty(int y) const { return rows_[y] == 0; }
+  void Clear() {
+    for (int y = 0; y < H; y++) {
+      WriteRow(y, 0);
+    }
+  }
+
+  // ClearRow removes row y and moves the rows above it down.
+  void ClearRow(int y) {
+    for (; y < H - 1; y++) {
+      WriteRow(y, rows_[y + 1]);
+    }
+    WriteRow(H - 1, 0);
+  }
+  // ClearFullRows removes all full rows, moves the rest down and returns the
+  // number of removed rows.
+  int ClearFullRows() {
+    int dst = 0;
+    for (int y = 0; y < H; y++) {
+      if (!IsRowFull(y)) {
+        if (dst != y) {
+          WriteRow(dst, rows_[y]);
+        }
+        dst++;
+      }
+    }
+    int cleared = H - dst;
+    for (; dst < H; dst++) {
+      WriteRow(dst, 0);
+    }
+    return cleared;
+  }
+
+  // Collides returns whether a shape at pos overlaps occupied cells. Bit x
+  // of shape[i] is the cell at pos + (x, i).
+  bool Collides(const Row* shape, int rows, ivec2 pos) const {
+    for (int i = 0; i < rows; i++) {
+      Row m = shape[i];
+      if (m == 0) {
+        continue;
+      }
+      int y = pos.y + i;
+      Row placed = ShiftRow(m, pos.x) & kFullRow;
+      Row lost = m & ~ShiftRow(placed, -pos.x);
+      if (lost && CollidesOutside(lost, pos.x, y)) {
+        return true;
+      }
+      if (uint32_t(y) >= uint32_t(H)) {
+        if (placed && CollidesOutside(ShiftRow(placed, -pos.x), pos.x, y)) {
+          return true;
+        }
+      } else if (rows_[y] & placed) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint64_t Hash() const {
+    static_assert(Hashed, "ngBitBoard is not hashed");
+    return hash_;
+  }
+
+  // Snapshot starts journaling changes and returns a mark for Restore.
+  // Snapshots nest, so a search takes one per node.
+  size_t Snapshot() {
+    journaling_ = true;
+    return journal_.size();
+  }
+  // Restore undoes the changes made after Snapshot returned mark.
+  void Restore(size_t mark) {
+    while (journal_.size() > mark) {
+      SwapRow(journal_.back().y, journal_.back().old);
+      journal_.pop_back();
+    }
+  }
+  // DropSnapshots stops journaling and forgets all marks.
+  void DropSnapshots() {
+    journal_.clear();
+    journaling_ = false;
+  }
+
+ private:
+  static Row ShiftRow(Row m, int x) {
+    if (x <= -64 || x >= 64) {
+      return 0;
+    }
+    return x >= 0 ? m << x : m >> -x;
+  }
+  // CollidesOutside asks Outside for each cell of m placed at (x, y).
+  bool CollidesOutside(Row m, int x, int y) const {
+    for (int b = 0; b < 64; b++) {
+      if ((m >> b) & 1 && Outside::Blocked(ivec2(x + b, y), Size())) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // WriteRow is the only place that changes rows_.
+  void WriteRow(int y, Row mask) {
+    if (rows_[y] == mask) {
+      return;
+    }
+    if (journaling_) {
+      journal_.push_back({y, rows_[y]});
+    }
+    SwapRow(y, mask);
+  }
+  void SwapRow(int y, Row mask) {
+    Row diff = Hashed ? rows_[y] ^ mask : 0;
+    for (int x = 0; diff; x++, diff >>= 1) {
+      if (diff & 1) {
+        hash_ ^= ngZobristKey(uint64_t(y) * W + x);
+      }
+    }
+    rows_[y] = mask;
+  }
+
+  struct JournalEntry {
+    int y;
+    Row old;
+  };
+
+  std::array<Row, H> rows_ = {};
+  uint64_t hash_ = 0;
+  bool journaling_ = false;
+  std::vector<JournalEntry> journal_;
+};  // struct ngBitBoard<W, H>
+
+// ngFixedBoard is a non-virtual W x H board of small cell values, where
+// Cell() is empty. An ngBitBoard of occupied cells is kept next to the
+// values, so collisions and row operations go through masks. Snapshot,
+// Restore and Hash work as with ngBitBoard, journaling changed cells; Cell
+// must convert to an integer for the hash.
+template <typename Cell, int W, int H, typename Outside = ngBoardWalls>
+struct ngFixedBoard {
+  typedef ngBitBoard<W, H, Outside, false> Bits;
+  typedef typename Bits::Row Row;
+  typedef std::array<Cell, W> CellRow;
+
+  constexpr ivec2 Size() const { return ivec2(W, H); }
+  static bool IsInside(ivec2 pos) { return Bits::IsInside(pos); }
+  const Bits& Occupied() const { return bits_; }
+  uint64_t Hash() const { return hash_; }
+
+  // GetAt returns Cell() outside the board.
+  const Cell& GetAt(ivec2 pos) const {
+    static const Cell kEmpty = Cell();
+    return IsInside(pos) ? cells_[pos.y][pos.x] : kEmpty;
+  }
+  void SetAt(ivec2 pos, const Cell& c) {
+    NG_ASSERT(IsInside(pos));
+    const Cell& old = cells_[pos.y][pos.x];
+    if (old == c) {
+      return;
+    }
+    if (journaling_) {
+      journal_.push_back({pos.x, pos.y, old});
+    }
+    SwapCell(pos.x, pos.y, c);
+  }
+  void Clear() {
+    for (int y = 0; y < H; y++) {
+      WriteRow(y, CellRow());
+    }
+  }
+
+  bool IsRowFull(int y) const { return bits_.IsRowFull(y); }
+  void ClearRow(int y) {
+    for (; y < H - 1; y++) {
+      WriteRow(y, cells_[y + 1]);
+    }
+    WriteRow(H - 1, CellRow());
+  }
+  int ClearFullRows() {
+    int dst = 0;
+    for (int y = 0; y < H; y++) {
+      if (!bits_.IsRowFull(y)) {
+        if (dst != y) {
+          WriteRow(dst, cells_[y]);
+        }
+        dst++;
+      }
+    }
+    int cleared = H - dst;
+    for (; dst < H; dst++) {
+      WriteRow(dst, CellRow());
+    }
+    return cleared;
+  }
+
+  bool Collides(const Row* shape, int rows, ivec2 pos) const {
+    return bits_.Collides(shape, rows, pos);
+  }
+
+  size_t Snapshot() {
+    journaling_ = true;
+    return journal_.size();
+  }
+  void Restore(size_t mark) {
+    while (journal_.size() > mark) {
+      const JournalEntry& e = journal_.back();
+      SwapCell(e.x, e.y, e.old);
+      journal_.pop_back();
+    }
+  }
+  void DropSnapshots() {
+    journal_.clear();
+    journaling_ = false;
+  }
+
+ private:
+  // SetAt and WriteRow are the only places that change cells_, and only
+  // changed cells are journaled and hashed.
+  void WriteRow(int y, const CellRow& row) {
+    Row mask = 0;
+    for (int x = 0; x < W; x++) {
+      const Cell& old = cells_[y][x];
+      if (!(old == row[x])) {
+        if (journaling_) {
+          journal_.push_back({x, y, old});
+        }
+        hash_ ^= CellKey(x, y, old) ^ CellKey(x, y, row[x]);
+      }
+      if (!(row[x] == Cell())) {
+        mask |= Row(1) << x;
+      }
+    }
+    cells_[y] = row;
+    bits_.SetRow(y, mask);
+  }
+  void SwapCell(int x, int y, const Cell& c) {
+    hash_ ^= CellKey(x, y, cells_[y][x]) ^ CellKey(x, y, c);
+    cells_[y][x] = c;
+    bits_.SetAt(ivec2(x, y), !(c == Cell()));
+  }
+  static uint64_t CellKey(int x, int y, const Cell& c) {
+    if (c == Cell()) {
+      return 0;
+    }
+    return ngZobristKey((uint64_t(y * W + x) << 32) + uint64_t(c));
+  }
+
+  struct JournalEntry {
+    int x;
+    int y;
+    Cell old;
+  };
+
+  std::array<CellRow, H> cells_ = {};
+  Bits bits_;
+  uint64_t hash_ = 0;
+  bool journaling_ = false;
+  std::vector<JournalEntry> journal_;
+};  // struct ngFixedBoard<Cell, W, H>
+
+// ngRectSoA stores rects as arrays of their edges, for the batch tests of
+// ngMath.
+struct ngRectSoA {
+  std::vector<float> left;
+  std::vector<float> right;
+  std::vector<float> bottom;
+  std::vector<float> top;
+
+  size_t Size() const { return left.size(); }
+  void Clear() {
+    left.clear();
+    right.clear();
+    bottom.clear();
+    top.clear();
+  }
+  void Reserve(size_t n) {
+    left.reserve(n);
+    right.reserve(n);
+    bottom.reserve(n);
+    top.reserve(n);
+  }
+  void Add(const ngRect& r) {
+    left.push_back(r.Left());
+    right.push_back(r.Right());
+    bottom.push_back(r.Bottom());
+    top.push_back(r.Top());
+  }
+  void Set(size_t i, const ngRect& r) {
+    left[i] = r.Left();
+    right[i] = r.Right();
+    bottom[i] = r.Bottom();
+    top[i] = r.Top();
+  }
+};
+
+// ngSweepHit is the first contact of a moving rect with another.
+struct ngSweepHit {
+  // fraction of the movement in [0..1] before the contact
+  float time;
+  // unit normal of the hit surface, pointing to the moving rect
+  vec2 normal;
+};
+
+// ngAffine2D is a 2D affine transform stored as the 2x3 part of a mat3,
+// mapping p to x_axis * p.x + y_axis * p.y + origin. Products and points
+// take a cheaper path while there is no rotation or shear.
+struct ngAffine2D {
+  vec2 x_axis = vec2(1.f, 0.f);
+  vec2 y_axis = vec2(0.f, 1.f);
+  vec2 origin = vec2(0.f);
+  // x_axis.y and y_axis.x are 0
+  bool axis_aligned = true;
+
+  static ngAffine2D TranslateScale(vec2 pos, vec2 scale) {
+    ngAffine2D t;
+    t.x_axis.x = scale.x;
+    t.y_axis.y = scale.y;
+    t.origin = pos;
+    return t;
+  }
+  // FromMat3 takes the affine part of m.
+  static ngAffine2D FromMat3(const mat3& m) {
+    ngAffine2D t;
+    t.x_axis = vec2(m[0]);
+    t.y_axis = vec2(m[1]);
+    t.origin = vec2(m[2]);
+    t.axis_aligned = t.x_axis.y == 0.f && t.y_axis.x == 0.f;
+    return t;
+  }
+
+  vec2 Apply(vec2 p) const {
+    if (axis_aligned) {
+      return vec2(x_axis.x * p.x, y_axis.y * p.y) + origin;
+    }
+    return x_axis * p.x + y_axis * p.y + origin;
+  }
+  // TranslateScaled returns *this * TranslateScale(pos, scale).
+  ngAffine2D TranslateScaled(vec2 pos, vec2 scale) const {
+    ngAffine2D t = *this;
+    t.origin = Apply(pos);
+    t.x_axis *= scale.x;
+    t.y_axis *= scale.y;
+    return t;
+  }
+  ngAffine2D operator*(const ngAffine2D& rhs) const {
+    if (rhs.axis_aligned) {
+      return TranslateScaled(rhs.origin, vec2(rhs.x_axis.x, rhs.y_axis.y));
+    }
+    ngAffine2D t;
+    t.x_axis = x_axis * rhs.x_axis.x + y_axis * rhs.x_axis.y;
+    t.y_axis = x_axis * rhs.y_axis.x + y_axis * rhs.y_axis.y;
+    t.origin = Apply(rhs.origin);
+    t.axis_aligned = t.x_axis.y == 0.f && t.y_axis.x == 0.f;
+    return t;
+  }
+};
+
 class ngMath {
  public:
   // TRS returns Translate * Rotate * Scale matrix.
@@ -194,22 +696,298 @@ class ngMath {
     }
     return false;
   }
+
+  // CollideRects sets bit i % 64 of hits[i / 64] if r collides with rect i
+  // of rects, as IsCollideRect does. hits needs (rects.Size() + 63) / 64
+  // words.
+  static void CollideRects(const ngRect& r, const ngRectSoA& rects,
+                           uint64_t* hits);
+  // CollideRects tests each rect a of as with all rects of bs, storing the
+  // hits of a from hits + a * ((bs.Size() + 63) / 64) as above.
+  static void CollideRects(const ngRectSoA& as, const ngRectSoA& bs,
+                           uint64_t* hits);
+
+  // SweepRect returns whether moving collides with target while moving by
+  // delta, as IsCollideRect would at some point of the way, and stores the
+  // first contact to hit. Unlike testing the end position, fast rects do not
+  // pass through thin ones. If they already collide, time is 0 and normal
+  // points out along the axis of least penetration.
+  static bool SweepRect(const ngRect& moving, vec2 delta, const ngRect& target,
+                        ngSweepHit* hit);
+  // ResolveSweep moves r to the contact of hit during delta, and reflects
+  // velocity off the hit surface scaled by bounce, 1 for an elastic ball and
+  // 0 to slide along it. It returns the rest of delta treated the same way,
+  // to sweep again against other rects.
+  static vec2 ResolveSweep(ngRect* r, vec2 delta, const ngSweepHit& hit,
+                           float bounce, vec2* velocity);
+};
+
+typedef int ngColliderId;
+
+struct ngColliderPair {
+  ngColliderId a;
+  ngColliderId b;
+};
+
+// ngCollisionWorld finds overlapping ngRects with a uniform grid, so a
+// frame costs about the number of nearby rects instead of all pairs.
+// Overlap is the same as ngMath::IsCollideRect. Each collider has layer
+// bits, e.g. 1 for bullets and 2 for enemies, to filter queries. cell_size
+// should be around the size of typical rects. Queries are not thread safe.
+class ngCollisionWorld {
+ public:
+  explicit ngCollisionWorld(float cell_size = 32.f);
+
+  ngColliderId Add(const ngRect& rect, uint32_t layers = 1);
+  // Move updates the grid only when rect covers other cells.
+  void Move(ngColliderId id, const ngRect& rect);
+  void Remove(ngColliderId id);
+  void Clear();
+  const ngRect& GetRect(ngColliderId id) const { return colliders_[id].rect; }
+
+  // Query appends colliders in any of layers overlapping rect to out.
+  void Query(const ngRect& rect, uint32_t layers,
+             std::vector<ngColliderId>* out) const;
+  // QueryPairs appends each overlapping pair once to out, with a in layers_a
+  // and b in layers_b.
+  void QueryPairs(uint32_t layers_a, uint32_t layers_b,
+                  std::vector<ngColliderPair>* out) const;
+
+ private:
+  struct Collider {
+    ngRect rect;
+    uint32_t layers;
+    // range of covered cells
+    ivec2 cell_min;
+    ivec2 cell_max;
+    bool alive;
+  };
+
+  ivec2 CellOf(vec2 pos) const;
+  int BucketOf(ivec2 cell) const;
+  void Link(ngColliderId id);
+  void Unlink(ngColliderId id);
+  void AddToBucket(int b, ngColliderId id);
+
+  float inv_cell_size_;
+  std::vector<Collider> colliders_;
+  std::vector<ngColliderId> free_ids_;
+  // cells are hashed to buckets, each of which lists a collider once.
+  std::vector<std::vector<ngColliderId>> buckets_;
+  // non-empty buckets, so that QueryPairs visits only them, and the index
+  // of each bucket in it or -1.
+  std::vector<int> occupied_;
+  std::vector<int> occupied_index_;
+  // marks colliders already visited by the current query
+  mutable std::vector<uint32_t> visit_mark_;
+  mutable uint32_t visit_ = 0;
+};
+
+// ngFramePhase is a part of a frame measured by the frame profiler.
+enum class ngFramePhase {
+  // sleeping in the low latency mode
+  SLEEP,
+  // polling platform events
+  EVENT,
+  // sampling input state
+  INPUT,
+  // all updater calls
+  UPDATE,
+  // renderer call and submitting draws
+  RENDER,
+  // presenting the frame, including wait for vsync
+  SWAP,
+  // whole frame
+  TOTAL,
+};
+const int kFramePhaseNum = 7;
+
+// ngFrameCounters counts GPU work of a frame. They stay zero with the
+// software backend.
+struct ngFrameCounters {
+  int draw_calls = 0;
+  int buffer_uploads = 0;
+  int texture_uploads = 0;
+};
+
+struct ngFrameStats {
+  // seconds spent in each ngFramePhase in the last frame.
+  float time[kFramePhaseNum] = {};
+  // percentiles of seconds spent in each ngFramePhase in recent frames.
+  float p50[kFramePhaseNum] = {};
+  float p95[kFramePhaseNum] = {};
+  float p99[kFramePhaseNum] = {};
+  ngFrameCounters counters;
+  float fps = 0.f;
+  // frames replayed since ngProcess::StartReplay and seconds taken, kept
+  // after the replay ends.
+  int replay_frames = 0;
+  float replay_time = 0.f;
+};
+
+// ngProfiler records nested zones of each thread with timestamps, to see
+// them on a timeline with chrome://tracing or Perfetto. Use NG_PROFILE_ZONE
+// rather than calling BeginZone and EndZone directly. name must be a string
+// which lives until export, like a string literal.
+class ngProfiler {
+ public:
+  static void BeginZone(const char* name);
+  static void EndZone();
+  // ExportChromeTrace writes recent zones of all threads as Chrome trace
+  // event JSON.
+  static bool ExportChromeTrace(const char* path);
+};
+
+struct ngProfileZone {
+  explicit ngProfileZone(const char* name) { ngProfiler::BeginZone(name); }
+  ~ngProfileZone() { ngProfiler::EndZone(); }
+  ngProfileZone(const ngProfileZone&) = delete;
+  ngProfileZone& operator=(const ngProfileZone&) = delete;
+};
+
+// NG_PROFILE_ZONE records a zone until the end of the scope. Zones are
+// compiled out unless NG_PROFILE is defined.
+#if defined(NG_PROFILE)
+#define NG_PROFILE_CONCAT_INNER(a, b) a##b
+#define NG_PROFILE_CONCAT(a, b) NG_PROFILE_CONCAT_INNER(a, b)
+#define NG_PROFILE_ZONE(name) \
+  ngProfileZone NG_PROFILE_CONCAT(ng_profile_zone_, __LINE__)(name)
+#else
+#define NG_PROFILE_ZONE(name)
+#endif
+#define NG_PROFILE_FUNCTION() NG_PROFILE_ZONE(__func__)
+
+// ngInputEvent is a press or release of a mapped action.
+struct ngInputEvent {
+  ngKeyCode code;
+  bool pressed;
+  // seconds since the process started, in milliseconds resolution.
+  double time;
+};
+
+// ngDrawList records draw commands without drawing, so that worker threads
+// can each fill their own list. ngProcess::SubmitDrawLists draws them on the
+// main thread, ordered by layer and then in recording order, so draws in a
+// layer overlap as if drawn directly.
+class ngDrawList {
+ public:
+  enum class Kind : uint8_t { RECT, CIRCLE, LINE, TEXT };
+  struct Command {
+    Kind kind;
+    int layer;
+    // index to Transforms() of the transform stack at the time of recording
+    uint32_t transform;
+    // RGBA, 8 bits each. border of RECT and CIRCLE, or color of the others.
+    uint32_t color;
+    // RGBA fill of RECT and CIRCLE, or offset of the text for TextAt()
+    uint32_t extra;
+    // center and size, both ends of a line, or position and length in b.x
+    vec2 a;
+    vec2 b;
+  };
+
+  ngDrawList() { Clear(); }
+  void Clear();
+  void SetLayer(int layer) { layer_ = layer; }
+  void Push(const ngAffine2D& t) {
+    stack_.push_back(stack_.back() * t);
+    transform_ = kNoTransform;
+  }
+  void Push(const mat3& mat) { Push(ngAffine2D::FromMat3(mat)); }
+  void Pop() {
+    stack_.pop_back();
+    transform_ = kNoTransform;
+  }
+
+  void Rect(const ngColor& border, const ngColor& fill, const vec2& center,
+            const vec2& size);
+  void Line(const ngColor& col, const vec2& pos1, const vec2& pos2);
+  void Circle(const ngColor& border, const ngColor& fill,
+              const ngCoord& center, float length);
+  void Text(const ngColor& col, const ngCoord& pos, float length,
+            const char* str);
+  // Append copies commands of other to the end of this list.
+  void Append(const ngDrawList& other);
+
+  const std::vector<Command>& Commands() const { return commands_; }
+  const std::vector<ngAffine2D>& Transforms() const { return transforms_; }
+  const char* TextAt(uint32_t offset) const { return &text_[offset]; }
+
+ private:
+  static const uint32_t kNoTransform = ~0u;
+
+  Command& Add(Kind kind);
+
+  int layer_;
+  std::vector<ngAffine2D> stack_;
+  // index to transforms_ of the top of stack_, added by the next command
+  uint32_t transform_;
+  std::vector<ngAffine2D> transforms_;
+  std::vector<Command> commands_;
+  std::vector<char> text_;
 };
 
 class ngProcess;
-typedef std::function<void(ngProcess&, float)> ngUpdater;
+// ngUpdater advances the game by dt seconds.
+typedef std::function<void(ngProcess&, float dt)> ngUpdater;
+// ngRenderer draws a frame. alpha is the fraction of a fixed timestep
+// elapsed since the last update, to interpolate between the last two states.
+typedef std::function<void(ngProcess&, float alpha)> ngRenderer;
+// ngRecorder advances the game by dt seconds and records its drawing to list.
+typedef std::function<void(ngProcess&, float dt, ngDrawList& list)>
+    ngRecorder;
 
 class ngProcess {
  public:
-  static std::unique_ptr<ngProcess> NewProcess();
+  static std::unique_ptr<ngProcess> NewProcess(
+      ngBackend backend = ngBackend::OPENGL);
+  virtual ~ngProcess() {}
 
   virtual bool Init() = 0;
+  // Run calls updater every frame until ExitLoop is called. Drawing is done
+  // in the updater.
   virtual void Run(ngUpdater updater) = 0;
+  // Run calls updater to advance the game, then renderer once per frame.
+  virtual void Run(ngUpdater updater, ngRenderer renderer) = 0;
+  // RunRecorded calls recorder instead of an updater, and draws the list it
+  // recorded in the last update each frame. With pipelined, the recorder of
+  // the next frame runs on a worker thread while the main thread draws the
+  // list of the previous one and waits for vsync, at the cost of a frame of
+  // latency. The recorder may then read input and time of ngProcess but
+  // must not draw on it or change its settings, and the UPDATE phase of
+  // FrameStats is the time waited for the worker. pipelined is ignored on
+  // Emscripten. With fixed timestep, the list of the last update is drawn
+  // as recorded, without interpolation by alpha.
+  virtual void RunRecorded(ngRecorder recorder, bool pipelined) = 0;
+  // SetFixedTimestep makes updater run with fixed dt of step seconds, as
+  // many times as needed to catch up with the elapsed time but at most
+  // max_steps times per frame. Elapsed time beyond that is dropped. Draw in
+  // the renderer when using this. step <= 0 restores variable timestep.
+  virtual void SetFixedTimestep(float step, int max_steps) = 0;
+  // SetLowLatencyMode makes each frame sleep before sampling input as long
+  // as presenting waited for vsync recently, so that input is sampled as
+  // late as possible, which benefits all of Run and RunRecorded. The
+  // renderer of Run also gets DrawCursorPos sampled again before it.
+  // max_queued_frames limits frames queued on GPU: 0 waits for each frame
+  // to finish, and negative leaves it to the driver. It has no effect on
+  // Emscripten, where the browser paces frames.
+  virtual void SetLowLatencyMode(bool enable, int max_queued_frames) = 0;
+  // StartRecording writes input and delta time of every frame to a binary
+  // log at path, until the process is destroyed.
+  virtual bool StartRecording(const char* path) = 0;
+  // StartReplay replays input and delta time from a log written by
+  // StartRecording instead of real ones, and Run returns at the end of it.
+  // With ngBackend::SOFTWARE, the log is replayed without window as fast as
+  // possible, and replay_frames and replay_time of FrameStats serve as a
+  // benchmark.
+  virtual bool StartReplay(const char* path) = 0;
   virtual void ExitLoop() = 0;
 
   // rendering methods
 
   virtual void Push(const mat3& mat) = 0;
+  // Push is cheaper with ngAffine2D than with mat3 built by ngMath::TRS.
+  virtual void Push(const ngAffine2D& t) = 0;
   virtual void Pop() = 0;
 
   virtual void Clear(const ngColor& col) = 0;
@@ -222,6 +1000,25 @@ class ngProcess {
                       const ngCoord& center, const float& length) = 0;
   virtual void Text(const ngColor& col, const ngCoord& pos, float length,
                     const char* str) = 0;
+  // SubmitDrawLists draws commands of n lists in the order described at
+  // ngDrawList, on top of the current transform. Call it from the thread
+  // running Run, after the lists are recorded.
+  virtual void SubmitDrawLists(const ngDrawList* const* lists, size_t n) = 0;
+
+  // SaveFrame writes what is drawn so far in this frame to a PNG file.
+  virtual bool SaveFrame(const char* path) = 0;
+
+  // profiling methods
+
+  // FrameStats returns timings and counters of the last frame.
+  virtual const ngFrameStats& FrameStats() = 0;
+  // ShowStatsOverlay toggles drawing FrameStats on top of the screen.
+  virtual void ShowStatsOverlay(bool show) = 0;
+  // SetTraceFile makes Run export profiling zones to path when it returns.
+  virtual void SetTraceFile(const char* path) = 0;
+  // MapTraceExport exports profiling zones to the trace file when code is
+  // just pressed.
+  virtual void MapTraceExport(ngKeyCode code) = 0;
 
   // input methods
 
@@ -234,6 +1031,21 @@ class ngProcess {
   virtual bool IsHold(ngKeyCode code) = 0;
   // IsKeyPress returns true only in one frame when key is pressed.
   virtual bool IsJustPressed(ngKeyCode code) = 0;
+  // IsJustReleased returns true only in one frame when key is released.
+  virtual bool IsJustReleased(ngKeyCode code) = 0;
+  // PressCount returns how many times key was pressed since the previous
+  // update. Taps released before the frame started are counted too.
+  virtual int PressCount(ngKeyCode code) = 0;
+  // InputEvents returns presses and releases since the previous update in
+  // the order they happened.
+  virtual const std::vector<ngInputEvent>& InputEvents() = 0;
 
+  // CursorPos returns the cursor sampled at the start of the frame, as
+  // updates see it and StartRecording records it.
   virtual ngCoord CursorPos() = 0;
+  // DrawCursorPos returns the cursor to draw, e.g. as a crosshair. In the
+  // low latency mode it is sampled again before the renderer of Run, except
+  // in replays. Updaters and recorders are called right after sampling
+  // input, where it equals CursorPos.
+  virtual ngCoord DrawCursorPos() = 0;
 };
@@ -0,0 +1,467 @@
+﻿// ng_test checks the parts of ng which don't need a window. It prints
+// failed checks and returns non-zero if any.
+#include <algorithm>
+#include <array>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "ng.h"
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(x)                                                       \
+  do {                                                                 \
+    if (!(x)) {                                                        \
+      fprintf(stderr, "failed CHECK %s at %s(%d)\n", #x, __FILE__,     \
+              __LINE__);                                               \
+      failures++;                                                      \
+    }                                                                  \
+  } while (0)
+
+ngRect randomRect(ngRand& rng, float extent, float max_size) {
+  ngRect r;
+  r.pos = rng.Float2D(vec2(-extent), vec2(extent));
+  r.size = rng.Float2D(vec2(0.1f), vec2(max_size));
+  return r;
+}
+
+void testBitBoard() {
+  const uint64_t kI[4] = {1, 1, 1, 1};
+  const uint64_t kO[2] = {3, 3};
+  ngBitBoard<10, 20, ngBoardOpenTop> b;
+  CHECK(!b.Collides(kI, 4, {0, 0}));
+  CHECK(b.Collides(kI, 4, {-1, 0}));
+  CHECK(b.Collides(kI, 4, {10, 0}));
+  CHECK(b.Collides(kO, 2, {9, 0}));
+  CHECK(!b.Collides(kO, 2, {8, 0}));
+  CHECK(b.Collides(kI, 4, {0, -1}));
+  // open above the top, even beyond the sides
+  CHECK(!b.Collides(kI, 4, {0, 18}));
+  CHECK(!b.Collides(kI, 4, {-3, 25}));
+  CHECK(b.Collides(kO, 2, {-1, 19}));
+
+  ngBitBoard<10, 20> walls;
+  CHECK(walls.Collides(kI, 4, {0, 18}));
+
+  ngBitBoard<64, 4> wide;
+  for (int x = 0; x < 64; x++) {
+    wide.SetAt({x, 0}, true);
+  }
+  CHECK(wide.IsRowFull(0));
+  CHECK(!wide.Collides(kI, 1, {63, 1}));
+  CHECK(wide.Collides(kO, 1, {63, 1}));
+
+  b.SetAt({3, 0}, true);
+  for (int x = 0; x < 10; x++) {
+    b.SetAt({x, 1}, true);
+  }
+  b.SetAt({5, 2}, true);
+  CHECK(b.Collides(kO, 2, {2, 0}));
+  CHECK(b.ClearFullRows() == 1);
+  CHECK(b.GetAt({3, 0}));
+  CHECK(b.GetAt({5, 1}));
+  CHECK(!b.GetAt({5, 2}));
+}
+
+void testSnapshot() {
+  ngBitBoard<10, 8> b;
+  uint64_t empty = b.Hash();
+  size_t mark = b.Snapshot();
+  b.SetAt({1, 1}, true);
+  uint64_t one = b.Hash();
+  size_t mark2 = b.Snapshot();
+  for (int x = 0; x < 10; x++) {
+    b.SetAt({x, 0}, true);
+  }
+  b.ClearFullRows();
+  CHECK(b.GetAt({1, 0}));
+  b.Restore(mark2);
+  CHECK(b.Hash() == one);
+  CHECK(b.GetAt({1, 1}) && !b.GetAt({0, 0}));
+  b.Restore(mark);
+  CHECK(b.Hash() == empty);
+  CHECK(!b.GetAt({1, 1}));
+
+  // the hash depends only on the contents
+  ngBitBoard<10, 8> other;
+  other.SetAt({1, 1}, true);
+  CHECK(other.Hash() == one);
+
+  enum Cell { NONE, RED, BLUE };
+  ngFixedBoard<Cell, 10, 8> f;
+  size_t fmark = f.Snapshot();
+  f.SetAt({2, 2}, RED);
+  uint64_t red = f.Hash();
+  f.SetAt({2, 2}, BLUE);
+  CHECK(f.Hash() != red);
+  CHECK(f.Occupied().GetAt({2, 2}));
+  for (int x = 0; x < 10; x++) {
+    f.SetAt({x, 0}, RED);
+  }
+  CHECK(f.ClearFullRows() == 1);
+  CHECK(f.GetAt({2, 1}) == BLUE);
+  f.Restore(fmark);
+  CHECK(f.Hash() == 0);
+  CHECK(f.GetAt({2, 2}) == NONE);
+  CHECK(!f.Occupied().GetAt({2, 2}));
+}
+
+void testCollisionWorld() {
+  const int kNum = 1000;
+  ngRand rng;
+  rng.Seed(2);
+  ngCollisionWorld world(16.f);
+  std::vector<ngRect> rects;
+  std::vector<uint32_t> layers;
+  std::vector<ngColliderId> ids;
+  std::vector<bool> alive;
+  for (int i = 0; i < kNum; i++) {
+    // some rects span many cells
+    rects.push_back(randomRect(rng, 300.f, rng.IntN(10) ? 8.f : 80.f));
+    layers.push_back(1u << rng.IntN(2));
+    ids.push_back(world.Add(rects[i], layers[i]));
+    alive.push_back(true);
+  }
+
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < kNum; i++) {
+      if (!alive[i]) {
+        continue;
+      }
+      int action = rng.IntN(10);
+      if (action == 0) {
+        world.Remove(ids[i]);
+        alive[i] = false;
+      } else if (action < 5) {
+        rects[i].pos += rng.Float2D(vec2(-5.f), vec2(5.f));
+        world.Move(ids[i], rects[i]);
+      }
+    }
+
+    std::set<std::pair<int, int>> expected;
+    for (int i = 0; i < kNum; i++) {
+      for (int j = 0; j < kNum; j++) {
+        if (i != j && alive[i] && alive[j] && (layers[i] & 1) &&
+            (layers[j] & 2) && ngMath::IsCollideRect(rects[i], rects[j])) {
+          expected.insert({ids[i], ids[j]});
+        }
+      }
+    }
+    std::vector<ngColliderPair> pairs;
+    world.QueryPairs(1, 2, &pairs);
+    std::set<std::pair<int, int>> found;
+    for (const ngColliderPair& p : pairs) {
+      found.insert({p.a, p.b});
+    }
+    CHECK(found == expected);
+    CHECK(found.size() == pairs.size());
+
+    ngRect query = randomRect(rng, 300.f, 40.f);
+    std::vector<ngColliderId> out;
+    world.Query(query, 3, &out);
+    std::set<ngColliderId> queried(out.begin(), out.end());
+    size_t overlapping = 0;
+    for (int i = 0; i < kNum; i++) {
+      if (alive[i] && ngMath::IsCollideRect(rects[i], query)) {
+        overlapping++;
+        CHECK(queried.count(ids[i]) == 1);
+      }
+    }
+    CHECK(out.size() == overlapping);
+  }
+
+  // only the buckets of new colliders are visited after Clear
+  world.Clear();
+  ngColliderId a = world.Add({{0.f, 0.f}, {10.f, 10.f}}, 1);
+  ngColliderId b = world.Add({{15.f, 0.f}, {10.f, 10.f}}, 2);
+  std::vector<ngColliderPair> pairs;
+  world.QueryPairs(1, 2, &pairs);
+  CHECK(pairs.size() == 1 && pairs[0].a == a && pairs[0].b == b);
+  world.Remove(a);
+  pairs.clear();
+  world.QueryPairs(1, 2, &pairs);
+  CHECK(pairs.empty());
+}
+
+void testCollideRects() {
+  ngRand rng;
+  rng.Seed(1);
+  std::vector<ngRect> as, bs;
+  ngRectSoA soa_a, soa_b;
+  for (int i = 0; i < 101; i++) {
+    as.push_back(randomRect(rng, 100.f, 5.f));
+    soa_a.Add(as.back());
+  }
+  for (int i = 0; i < 1027; i++) {
+    bs.push_back(randomRect(rng, 100.f, 5.f));
+    soa_b.Add(bs.back());
+  }
+  // touching edges don't collide
+  as.push_back({{0.f, 0.f}, {1.f, 1.f}});
+  soa_a.Add(as.back());
+  bs[0] = {{2.f, 0.f}, {1.f, 1.f}};
+  soa_b.Set(0, bs[0]);
+
+  size_t words = (bs.size() + 63) / 64;
+  std::vector<uint64_t> hits(as.size() * words);
+  ngMath::CollideRects(soa_a, soa_b, hits.data());
+  int mismatches = 0;
+  for (size_t a = 0; a < as.size(); a++) {
+    for (size_t b = 0; b < bs.size(); b++) {
+      bool hit = (hits[a * words + b / 64] >> (b % 64)) & 1;
+      mismatches += hit != ngMath::IsCollideRect(as[a], bs[b]);
+    }
+  }
+  CHECK(mismatches == 0);
+
+  std::vector<uint64_t> row(words);
+  ngMath::CollideRects(as[3], soa_b, row.data());
+  CHECK(std::equal(row.begin(), row.end(), hits.begin() + 3 * words));
+}
+
+void testSweepRect() {
+  ngSweepHit hit;
+  ngRect ball = {{0.f, 0.f}, {2.f, 2.f}};
+  ngRect wall = {{50.f, 0.f}, {1.f, 100.f}};
+  CHECK(ngMath::SweepRect(ball, {100.f, 0.f}, wall, &hit));
+  CHECK(abs(hit.time - 0.47f) < 1e-5f);
+  CHECK(hit.normal == vec2(-1.f, 0.f));
+  // stops short, and moves along
+  CHECK(!ngMath::SweepRect(ball, {40.f, 0.f}, wall, &hit));
+  CHECK(!ngMath::SweepRect(ball, {0.f, 100.f}, wall, &hit));
+  // only touching at the end of the move
+  ngRect unit = {{0.f, 0.f}, {1.f, 1.f}};
+  ngRect target = {{5.f, 0.f}, {1.f, 1.f}};
+  CHECK(!ngMath::SweepRect(unit, {3.f, 0.f}, target, &hit));
+  // sliding along an edge
+  ngRect side = {{4.f, 0.f}, {2.f, 2.f}};
+  CHECK(!ngMath::SweepRect(ball, {0.f, 5.f}, side, &hit));
+  // exact corner
+  ngRect corner = {{10.f, 10.f}, {2.f, 2.f}};
+  CHECK(ngMath::SweepRect(ball, {20.f, 20.f}, corner, &hit));
+  CHECK(abs(hit.time - 0.3f) < 1e-5f);
+  CHECK(abs(hit.normal.x - hit.normal.y) < 1e-6f && hit.normal.x < 0.f);
+  // already colliding
+  ngRect inside = {{1.f, 0.f}, {2.f, 2.f}};
+  CHECK(ngMath::SweepRect(ball, {0.f, 0.f}, inside, &hit));
+  CHECK(hit.time == 0.f && hit.normal == vec2(-1.f, 0.f));
+
+  vec2 velocity(100.f, 10.f);
+  ngRect moving = ball;
+  CHECK(ngMath::SweepRect(moving, velocity, wall, &hit));
+  vec2 rest = ngMath::ResolveSweep(&moving, velocity, hit, 1.f, &velocity);
+  CHECK(abs(moving.pos.x - 47.f) < 1e-4f);
+  CHECK(velocity == vec2(-100.f, 10.f));
+  CHECK(rest.x < 0.f);
+}
+
+void testFillUInt64() {
+  const uint64_t kSeed = 42;
+  // lanes start from the seeded state, each jumped once more
+  splitmix64 smix = {kSeed};
+  xoshiro256plusplus single;
+  for (int i = 0; i < 4; i++) {
+    single.s[i] = smix.next();
+  }
+  xoshiro256plusplus lanes[ngRand::kLaneNum];
+  xoshiro256plusplus lane = single;
+  for (int l = 0; l < ngRand::kLaneNum; l++) {
+    lane.jump();
+    lanes[l] = lane;
+  }
+
+  ngRand rng;
+  rng.Seed(kSeed);
+  CHECK(rng.UInt64() == single.next());
+  const size_t kSizes[] = {1, 3, 4, 5, 13};
+  for (size_t n : kSizes) {
+    uint64_t out[16];
+    rng.FillUInt64(out, n);
+    // each call advances all lanes by whole rounds
+    uint64_t expected[16];
+    for (size_t j = 0; j < (n + 3) / 4 * 4; j++) {
+      expected[j] = lanes[j % ngRand::kLaneNum].next();
+    }
+    CHECK(std::equal(out, out + n, expected));
+    CHECK(rng.UInt64() == single.next());
+  }
+
+  float floats[13];
+  rng.FillFloat(floats, 13);
+  CHECK(std::all_of(floats, floats + 13,
+                    [](float f) { return f >= 0.f && f < 1.f; }));
+  vec2 points[7];
+  rng.FillFloat2D(points, 7, {-2.f, 10.f}, {2.f, 20.f});
+  CHECK(std::all_of(points, points + 7, [](vec2 v) {
+    return v.x >= -2.f && v.x < 2.f && v.y >= 10.f && v.y < 20.f;
+  }));
+  CHECK(rng.UInt64() == single.next());
+}
+
+void testIntN() {
+  ngRand rng;
+  rng.Seed(7);
+  const int kBounds[] = {1, 3, 7, 1000003, 0x7fffffff};
+  for (int bound : kBounds) {
+    bool in_range = true;
+    for (int i = 0; i < 1000; i++) {
+      int v = rng.IntN(bound);
+      in_range = in_range && v >= 0 && v < bound;
+    }
+    CHECK(in_range);
+    const size_t kSizes[] = {1, 3, 5, 13, 1001};
+    for (size_t n : kSizes) {
+      std::vector<int> out(n, -1);
+      rng.FillIntN(out.data(), n, bound);
+      CHECK(std::all_of(out.begin(), out.end(),
+                        [&](int v) { return v >= 0 && v < bound; }));
+    }
+  }
+
+  // each of 6 values within 5% of the expected count
+  const int kDraws = 60000;
+  int counts[6] = {};
+  int fill_counts[6] = {};
+  std::vector<int> fill(kDraws);
+  rng.FillIntN(fill.data(), kDraws, 6);
+  for (int i = 0; i < kDraws; i++) {
+    counts[rng.IntN(6)]++;
+    fill_counts[fill[i]]++;
+  }
+  for (int v = 0; v < 6; v++) {
+    CHECK(abs(counts[v] - kDraws / 6) < kDraws / 6 / 20);
+    CHECK(abs(fill_counts[v] - kDraws / 6) < kDraws / 6 / 20);
+  }
+
+  ngRand legacy;
+  ngRand raw;
+  legacy.SetLegacyIntN(true);
+  bool same = true;
+  for (int i = 0; i < 100; i++) {
+    int n = 1 + i * 37;
+    same = same && legacy.IntN(n) == int(raw.UInt64() % n);
+  }
+  CHECK(same);
+}
+
+void testSplit() {
+  ngRand a;
+  ngRand b;
+  a.Seed(3);
+  b.Seed(3);
+  CHECK(a.Split(0).empty());
+  CHECK(a.Split(-1).empty());
+  b.Split(0);
+  b.Split(-1);
+
+  std::vector<ngRand> as = a.Split(3);
+  std::vector<ngRand> bs = b.Split(3);
+  CHECK(as.size() == 3 && bs.size() == 3);
+  // the same state splits the same
+  std::set<uint64_t> firsts;
+  for (int i = 0; i < 3; i++) {
+    uint64_t x[4];
+    uint64_t y[4];
+    as[i].FillUInt64(x, 4);
+    bs[i].FillUInt64(y, 4);
+    CHECK(std::equal(x, x + 4, y));
+    uint64_t first = as[i].UInt64();
+    CHECK(first == bs[i].UInt64());
+    firsts.insert(first);
+  }
+  // children differ from each other, the parent and a later split
+  uint64_t parent = a.UInt64();
+  CHECK(parent == b.UInt64());
+  firsts.insert(parent);
+  std::vector<ngRand> later = a.Split(3);
+  for (ngRand& child : later) {
+    firsts.insert(child.UInt64());
+  }
+  CHECK(firsts.size() == 7);
+}
+
+struct Digits : ngShuffledBuffer<int> {
+  void Fill() override {
+    for (int i = 0; i < 5; i++) {
+      buffer_.push_back(i);
+    }
+  }
+};
+
+void testBag() {
+  const std::array<int, 7> kItems = {0, 1, 2, 3, 4, 5, 6};
+  const int kRounds = 700;
+  ngRand rng;
+  ngBag<int, 7> bag(kItems);
+  // each refill is a permutation, and the last item comes first sometimes,
+  // which Sattolo's shuffle never does
+  bool permutations = true;
+  int last_first = 0;
+  for (int r = 0; r < kRounds; r++) {
+    std::array<int, 7> popped;
+    for (int& v : popped) {
+      v = bag.Pop(rng);
+    }
+    last_first += popped[0] == 6;
+    std::sort(popped.begin(), popped.end());
+    permutations = permutations && popped == kItems;
+  }
+  CHECK(permutations);
+  CHECK(last_first > kRounds / 7 / 2 && last_first < kRounds / 7 * 2);
+
+  // PopN across refills gives the same sequence as Pop
+  ngRand rng_pop;
+  ngRand rng_pop_n;
+  ngBag<int, 7> bag_pop(kItems);
+  ngBag<int, 7> bag_pop_n(kItems);
+  std::vector<int> popped;
+  std::vector<int> popped_n;
+  const size_t kCounts[] = {3, 5, 1, 7, 13, 2};
+  for (size_t n : kCounts) {
+    for (size_t i = 0; i < n; i++) {
+      popped.push_back(bag_pop.Pop(rng_pop));
+    }
+    popped_n.resize(popped_n.size() + n);
+    bag_pop_n.PopN(rng_pop_n, popped_n.data() + popped_n.size() - n, n);
+  }
+  CHECK(popped == popped_n);
+  CHECK(bag_pop.Remaining() == bag_pop_n.Remaining());
+
+  Digits digits;
+  permutations = true;
+  last_first = 0;
+  for (int r = 0; r < kRounds; r++) {
+    std::array<int, 5> d;
+    for (int& v : d) {
+      v = digits.Pop(rng);
+    }
+    last_first += d[0] == 4;
+    std::sort(d.begin(), d.end());
+    permutations = permutations && d == std::array<int, 5>{0, 1, 2, 3, 4};
+  }
+  CHECK(permutations);
+  CHECK(last_first > kRounds / 5 / 2 && last_first < kRounds / 5 * 2);
+}
+
+}  // namespace
+
+int main(void) {
+  testBitBoard();
+  testSnapshot();
+  testCollisionWorld();
+  testCollideRects();
+  testSweepRect();
+  testFillUInt64();
+  testIntN();
+  testSplit();
+  testBag();
+  if (failures > 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}